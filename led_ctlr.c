@@ -8,82 +8,435 @@
 
 #include "app_error.h"
 #include "app_util.h"
+#include "app_util_platform.h"
 #include "app_timer.h"
+#include "nrf_atomic.h"
 
 #include "led_ctlr.h"
 #include "led_show.h"
+#include "led_vm.h"
+#include "led_fx.h"
+#include "led_stack.h"
 
 #define sizeofarr(a) (sizeof(a)/sizeof(a[0]))
 
+#define LS_NO_FRAME 0xFFFF      // frame number that does not exist
+#define LS_CURSOR_INDEX_SIZE 8  // number of indexed stream positions, 1 keeps only the first frame
+#define LS_MAX_SEEK_DEPTH 4     // max nesting of references resolved while seeking
+#define LS_TIME_INDEX_SIZE 8    // number of time index entries
+#define LS_TIME_WALK_LIMIT 20000    // max frames walked to build time index on the first seek
+#define LS_SNAPSHOT_MEMORY 8192 // RAM for frame snapshots of all streams, 0 disables snapshots
+#define LS_SNAPSHOT_INTERVAL 100    // time between frame snapshots (in refresh periods)
+#define LS_DELTA_HISTORY 4      // Sparse and Shift frames kept to bring a stale frame buffer up to date
+
+// set LS_SINGLE_BUFFER to 1 to keep one frame buffer per stream for long rows
+//  frames are then updated in place by refresh timer after the rows were sent, so a slow frame delays output
+#ifndef LS_SINGLE_BUFFER
+#define LS_SINGLE_BUFFER 0
+#endif
+#if LS_SINGLE_BUFFER
+#define LS_STREAM_BUFFER_COUNT 1
+#else
+#define LS_STREAM_BUFFER_COUNT 3    // frame buffers per stream - shown, ready and calculated frame
+#endif
+
 //  stream info
+typedef struct stream_cursor    // position in the stream
+{
+    uint32_t offset;            // offset of the frame header in the stream
+    uint16_t frame;             // frame number
+    uint16_t base;              // last frame that defined frame geometry
+    uint8_t depth;              // number of open loops
+    uint8_t rowCount;           // frame geometry defined by the last Base
+    uint16_t ledCount[LS_MAX_ROW_COUNT];
+} stream_cursor_t;
+
 typedef struct stream_frame     // frame info
 {
+    uint16_t number;            // frame number
     uint16_t duration;          // in refresh periods
     uint16_t repeat;            // repeat counter
-    ls_frame_format_t format;   // step format
-    uint32_t offset;            // offset to beginning of step data in showStream (after 'format' byte)
+    ls_frame_format_t format;   // step format, Reference - format of the referenced frame
+    const uint8_t* data;        // step data (after 'format' byte), Reference - data of the referenced frame
+    uint16_t base;              // Base frame the frame was validated against
+    uint16_t link;              // Jump - target frame
 } stream_frame_t;
 
+typedef struct stream_loop      // open loop
+{
+    stream_cursor_t start;      // first frame of the loop body
+    uint16_t count;             // remaining iterations, 0 repeats forever
+    uint32_t shown;             // frames shown before the loop body
+} stream_loop_t;
+
+typedef struct stream_state     // playback position
+{
+    uint32_t time;          // number of streamNext() calls since stream start
+    stream_frame_t frame;   // current frame
+    stream_cursor_t next;   // position after current frame
+    uint16_t frameDuration; // current frame duration
+    uint16_t frameRepeat;   // current frame repeat counter
+    stream_loop_t loop[LS_MAX_LOOP_DEPTH];  // open loops
+    uint32_t shown;         // number of frames selected to show
+    uint16_t currBase;      // Base frame that defines current frame geometry
+    bool halted;            // control frames do not lead to any frame to show
+} stream_state_t;
+
+typedef struct stream_time      // time index entry
+{
+    stream_state_t state;   // playback position after Base frame was calculated
+    stream_frame_t frame;   // the Base frame
+} stream_time_t;
+
+typedef struct stream_snapshot  // playback position and frame content
+{
+    const struct stream_info* stream;   // stream the snapshot belongs to, NULL if the slot is empty
+    stream_state_t state;
+    uint8_t rowCount;
+    uint16_t ledCount[LS_MAX_ROW_COUNT];
+    uint16_t rowStart[LS_MAX_ROW_COUNT];
+    led_ctlr_pixel_t frame[LS_MAX_ROW_COUNT * LS_MAX_LED_COUNT];
+} stream_snapshot_t;
+
+#if LS_SNAPSHOT_MEMORY > 0
+#define LS_SNAPSHOT_COUNT (LS_SNAPSHOT_MEMORY / sizeof(stream_snapshot_t))
+
+// LS_SNAPSHOT_MEMORY must hold at least one snapshot of LS_MAX_ROW_COUNT x LS_MAX_LED_COUNT frame
+STATIC_ASSERT(LS_SNAPSHOT_COUNT >= 1);
+
+// snapshots of all streams taken every LS_SNAPSHOT_INTERVAL, slot is selected by stream and time
+//  so the cache keeps the latest snapshots, streams played together share the slots
+static stream_snapshot_t snapshots[LS_SNAPSHOT_COUNT];
+
+// snapshot size for tools/ram_report.py, the array is not referenced,
+//  the linker discards it and the map file lists its size with the discarded sections
+const uint8_t led_ctlr_snapshot_size[sizeof(stream_snapshot_t)] = { 0 };
+#endif
+
+typedef struct stream_delta     // Sparse or Shift frame applied to the previous frame
+{
+    ls_frame_format_t format;
+    const uint8_t* data;        // frame data (after 'format' byte)
+} stream_delta_t;
+
+typedef struct stream_buffer    // frame buffer in the arena and geometry of the frame it holds
+{
+    led_ctlr_pixel_t* frame;
+    uint32_t seq;               // sequence number of the frame, see stream_info_t.calcSeq
+    uint8_t rowCount;
+    uint16_t ledCount[LS_MAX_ROW_COUNT];
+    uint16_t rowStart[LS_MAX_ROW_COUNT];    // index of the first led in the row buffer
+} stream_buffer_t;
+
+#define LS_BUFFER_FRESH 0x80    // flag of stream_info_t.ready - buffer was not yet taken by output
+
 
 typedef struct stream_info
 {
     const uint8_t* stream;
+    uint32_t length;            // stream length in bytes
 
+    uint8_t indexSize;          // size of led counts, led indices and frame numbers - 1 in v1, 2 in v2 stream
+    uint8_t maxRowCount;        // frame geometry limit while the stream is verified, then the largest
+    uint16_t maxLedCount;       //  geometry of its frames, also distance between rows in frame buffers
     uint8_t refreshPeriod;
-    uint8_t frameCount;
-    stream_frame_t frame[LS_MAX_FRAME_COUNT];
-
-    // current frame info
-    uint8_t frameNumber;    // current frame number
-    uint8_t frameDuration;  // current frame duration
-    uint8_t frameRepeat;    // current frame repeat counter
-
-    // current frame info
-    uint32_t * currFrame;       // points to current frame to show
-    uint8_t currRow;
-    uint8_t currRowCount;
-    uint8_t currLedCount[LS_MAX_ROW_COUNT];
-    uint32_t showFrame1[LS_MAX_ROW_COUNT * LS_MAX_LED_COUNT];
-    uint32_t showFrame2[LS_MAX_ROW_COUNT * LS_MAX_LED_COUNT];
+    uint16_t frameCount;
+    const uint8_t* palette;     // palette block in the stream, 3 bytes per color
+    uint16_t paletteSize;       // number of colors in palette, 0 if stream has no palette
+
+    // frames are decoded when the cursor reaches them, index keeps cursors
+    //  at every indexStride-th frame for jumps and references, offset 0 if not yet reached
+    stream_cursor_t index[LS_CURSOR_INDEX_SIZE];
+    uint32_t indexStride;
+
+    // playback position
+    stream_state_t state;
+
+    // playback positions at some of Base frames, sorted by time, built when the stream is loaded
+    //  seek walks frame headers from the closest one and calculates frames from the last Base on the way
+    stream_time_t timeIndex[LS_TIME_INDEX_SIZE];
+    uint8_t timeCount;      // number of entries in timeIndex
+    uint32_t timeSpacing;   // min time between entries
+    uint32_t timeLoop;      // position after timeLoop repeats every timePeriod, positions up to
+    uint32_t timePeriod;    //  timeLoop + timePeriod are indexed, timePeriod 0 if playback does not repeat
+    bool timeIndexed;       // index was built by streamTimeIndex(), first seek builds it
+
+    uint32_t snapshotHits;  // seeks that restored a snapshot
+    uint32_t snapshotMisses;
+    bool seeking;           // frames before seek time are being calculated
+    bool baseWarned;        // frame that does not follow its Base was logged, it is logged once per stream
+
+    // frames are calculated by compute interrupt and shown by refresh timer
+    //  each side owns one buffer, the third one is exchanged through 'ready'
+    stream_buffer_t buffer[LS_STREAM_BUFFER_COUNT];
+    uint8_t work;               // buffer being calculated (compute)
+    nrf_atomic_u32_t ready;     // latest complete buffer, LS_BUFFER_FRESH if not yet taken
+    uint8_t shownBuffer;        // buffer shown (output)
+    stream_buffer_t* curr;      // last calculated frame (compute), NULL if none
+    uint32_t calcSeq;           // sequence number of the last calculated frame
+    uint32_t fullSeq;           // last frame calculated without the previous one
+
+    // Sparse and Shift frames only change some leds of the previous frame, buffer they are
+    //  calculated in is brought up to date by applying the frames it missed, not by copying
+    stream_delta_t delta[LS_DELTA_HISTORY];     // frame with sequence number n is in slot n % LS_DELTA_HISTORY
+    stream_buffer_t* shown;     // frame shown (output), NULL if none
+    uint32_t frameSeq;          // incremented when shown frame changes
 
     uint8_t currRefresh;
+    volatile uint32_t due;      // frames due since play or seek (output)
+    uint32_t done;              // frames calculated since play or seek (compute)
 
 } stream_info_t;
 
 APP_TIMER_DEF(led_task_timer);
 led_ctlr_hw_t* led_ctlr = NULL;
-static stream_info_t curr_stream;
 
+// row of a layer, shows row of a stream or pixels set by host
+typedef struct layer_row
+{
+    stream_info_t* stream;      // stream shown on the row, NULL if the row shows host pixels
+    uint8_t row;                // row of the stream
+    uint16_t hostCount;         // number of host pixels, 0 if the row is not used
+    uint32_t hostSeq;           // incremented when host pixels change
+    uint32_t frameSeq;          // stream frame or host pixels last composed
+} layer_row_t;
+
+// layers are composed bottom up into output rows
+typedef struct layer
+{
+    led_ctlr_blend_t blend;
+    uint16_t opacity;           // 0..256
+    layer_row_t row[LS_MAX_ROW_COUNT];
+    uint32_t host[LS_MAX_ROW_COUNT * LS_MAX_LED_COUNT];     // host pixels AAGGRRBB
+} layer_t;
+
+static stream_info_t streams[LS_MAX_STREAM_COUNT];
+static layer_t layers[LS_MAX_LAYER_COUNT];
+static led_ctlr_pixel_t rowOut[LS_MAX_ROW_COUNT * LS_MAX_LED_COUNT];   // composed output rows
+static bool rowDirty[LS_MAX_ROW_COUNT];     // layer settings changed since the row was sent
+static uint8_t currRow;         // next output row to refresh
+static uint8_t particleLayer = LS_MAX_LAYER_COUNT;  // layer showing particles, LS_MAX_LAYER_COUNT if none
+
+// frame buffers of streams, kept in stream order without gaps
+static led_ctlr_pixel_t arena[LS_ARENA_MEMORY / sizeof(led_ctlr_pixel_t)];
+static uint32_t arenaSize[LS_MAX_STREAM_COUNT];     // pixels used by each stream
+
+#if LS_PIXEL_PACKED
+// gradient, program and effect rows are calculated as 00GGRRBB and packed to the frame buffer
+static uint32_t rowWide[LS_MAX_LED_COUNT];
+#endif
+
+// read led count, led index or frame number
+//  1 byte in v1 streams, 2 bytes LE in v2 streams
+static uint16_t getIndex(const uint8_t** p, uint8_t size)
+{
+    uint16_t v = *(*p)++;
+    if (size > 1)
+        v |= (uint16_t)(*(*p)++) << 8;
+    return v;
+}
+
+// number of bits per led value in base frame formats
+static uint8_t ledBits(uint8_t format)
+{
+    switch (format)
+    {
+    case ls_frame_Index8:
+        return 8;
+    case ls_frame_Index4:
+        return 4;
+    case ls_frame_Index2:
+        return 2;
+    default:
+        return 24;
+    }
+}
+
+// generate row of leds from gradient color stops
+//  interpolation uses 16.16 fixed point so each led costs one add per color
+//  each stop is led index (1 or 2 bytes) followed by RR GG BB
+static void gradientRow(uint32_t* r, uint16_t ledCount, uint16_t stopCount, const uint8_t* p, uint8_t size)
+{
+    uint16_t led = 0;
+    uint16_t end = getIndex(&p, size);
+
+    // leds before first stop
+    for (; led < end; led++)
+        r[led] = PIXEL(p[0], p[1], p[2]);
+
+    // p points to the color of the stop at the beginning of the segment
+    for (uint16_t stop = 1; stop < stopCount; stop++)
+    {
+        const uint8_t* c = p;
+        p += 3;
+
+        int32_t span = getIndex(&p, size) - end;
+        end += span;
+
+        int32_t R = ((int32_t)c[0] << 16) + 0x8000;
+        int32_t G = ((int32_t)c[1] << 16) + 0x8000;
+        int32_t B = ((int32_t)c[2] << 16) + 0x8000;
+        int32_t dR = (((int32_t)p[0] - c[0]) << 16) / span;
+        int32_t dG = (((int32_t)p[1] - c[1]) << 16) / span;
+        int32_t dB = (((int32_t)p[2] - c[2]) << 16) / span;
+
+        for (; led < end; led++)
+        {
+            r[led] = PIXEL(R >> 16, G >> 16, B >> 16);
+            R += dR;
+            G += dG;
+            B += dB;
+        }
+    }
+
+    // last stop and leds after it
+    for (; led < ledCount; led++)
+        r[led] = PIXEL(p[0], p[1], p[2]);
+}
+
+// buffer for a row calculated as 00GGRRBB, frame buffer row itself unless pixels are packed
+static uint32_t* rowWideGet(led_ctlr_pixel_t* r)
+{
+#if LS_PIXEL_PACKED
+    return rowWide;
+#else
+    return r;
+#endif
+}
+
+// store row returned by rowWideGet() to frame buffer row
+static void rowWidePut(led_ctlr_pixel_t* r, uint16_t ledCount)
+{
+#if LS_PIXEL_PACKED
+    for (uint16_t led = 0; led < ledCount; led++)
+        led_ctlr_pixel_set(&r[led], rowWide[led]);
+#else
+    UNUSED_PARAMETER(r);
+    UNUSED_PARAMETER(ledCount);
+#endif
+}
+
+// frames that define frame geometry
+static bool isBase(uint8_t format)
+{
+    switch (format)
+    {
+    case ls_frame_Base:
+    case ls_frame_Index8:
+    case ls_frame_Index4:
+    case ls_frame_Index2:
+    case ls_frame_Gradient:
+    case ls_frame_Reference:
+    case ls_frame_Program:
+    case ls_frame_Effect:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// parse stream header and palette, frames are parsed by frameParse() when playback reaches them
 static int parseStream(const uint8_t* stream, size_t length, stream_info_t* info)
 {
-    int status;
+    int status = NRF_ERROR_INVALID_DATA;
     const uint8_t *p, *b; // current position in the stream
     uint32_t l;
     uint8_t refresh;
-    uint8_t frame;
-    uint8_t frameCount;
+    uint16_t frameCount;
+    uint8_t idx;            // size of led counts, led indices and frame numbers
+
+    static const uint8_t v2magic[] = LS_STREAM_V2_MAGIC;
 
     info->stream = stream;
 
     b = p = stream;
 
-    //      - total length in 4-byte words not including first 4 bytes - 2 bytes LE - max size of the stream is 256K
-    //      - refresh period - 1 byte (in LS_REFRESH_UNIT) - refresh period length = refresh_period * LS_REFRESH_UNIT
-    //      - frame count - 1 byte (from 1 to LS_MAX_FRAME_COUNT)
+    info->palette = NULL;
+    info->paletteSize = 0;
+    info->maxRowCount = 0;
+    info->maxLedCount = 0;
 
-    if (length < 4)
+    if (length >= sizeof(ls_stream_header_v2_t) && memcmp(stream, v2magic, sizeof(v2magic)) == 0)
     {
-        NRF_LOG_ERROR("Stream (length %d) is too short", length);
-        goto RetErr;
+        //      - magic - 4 bytes
+        //      - total length in bytes including header - 4 bytes LE
+        //      - refresh period - 1 byte (in LS_REFRESH_UNIT)
+        //      - flags - 1 byte
+        //      - frame count - 2 bytes LE (from 1 to LS_MAX_FRAME_COUNT)
+        //      - row count - 1 byte (0..LS_MAX_ROW_COUNT)
+        //      - led count - 2 bytes LE (0..LS_MAX_LED_COUNT)
+        //      - reserved - 1 byte
+
+        const ls_stream_header_v2_t* h = (const ls_stream_header_v2_t*)stream;
+
+        idx = 2;
+
+        l = h->length[0];
+        l += (uint32_t)h->length[1] << 8;
+        l += (uint32_t)h->length[2] << 16;
+        l += (uint32_t)h->length[3] << 24;
+        if (l == 0)
+            l = length;
+        refresh = h->refresh;
+        frameCount = h->count[0];
+        frameCount += (uint16_t)h->count[1] << 8;
+
+        if (h->flags & ~LS_STREAM_PALETTE)
+        {
+            NRF_LOG_ERROR("Stream flags 0x%02x are invalid", h->flags);
+            goto RetErr;
+        }
+
+        if (h->reserved != 0)
+        {
+            NRF_LOG_ERROR("Stream header reserved byte is not 0");
+            goto RetErr;
+        }
+
+        info->maxRowCount = h->rows;
+        info->maxLedCount = h->leds[0] | ((uint16_t)h->leds[1] << 8);
+
+        if (info->maxRowCount > LS_MAX_ROW_COUNT || info->maxLedCount > LS_MAX_LED_COUNT)
+        {
+            NRF_LOG_ERROR("Stream geometry %d x %d is invalid", info->maxRowCount, info->maxLedCount);
+            goto RetErr;
+        }
+
+        if (h->flags & LS_STREAM_PALETTE)
+            info->paletteSize = LS_MAX_PALETTE_SIZE;
+
+        p += sizeof(ls_stream_header_v2_t);
     }
+    else
+    {
+        //      - total length in 4-byte words not including first 4 bytes - 2 bytes LE - max size of the stream is 256K
+        //      - refresh period - 1 byte (in LS_REFRESH_UNIT) - refresh period length = refresh_period * LS_REFRESH_UNIT
+        //      - frame count - 1 byte (from 1 to 127)
+
+        if (length < 4)
+        {
+            NRF_LOG_ERROR("Stream (length %d) is too short", length);
+            goto RetErr;
+        }
+
+        idx = 1;
+
+        l = *p++;
+        l += (uint32_t)(*p++) << 8;
+        l *= 4;                 // convert to bytes
+        if (l == 0)
+            l = length;
+        else
+            l += 4;
+        refresh = *p++;
+        frameCount = *p++;
 
-    l = *p++;
-    l += (uint32_t)(*p++) << 8;
-    l *= 4;                 // convert to bytes
-    if (l == 0)
-        l = length;
-    refresh = *p++;
-    frameCount = *p++;
+        if (frameCount & LS_STREAM_PALETTE)
+        {
+            frameCount &= ~LS_STREAM_PALETTE;
+            info->paletteSize = LS_MAX_PALETTE_SIZE;
+        }
+    }
 
     if (l > length )
     {
@@ -91,161 +444,95 @@ static int parseStream(const uint8_t* stream, size_t length, stream_info_t* info
         goto RetErr;
     }
 
+    if (l < (uint32_t)(p - b))
+    {
+        NRF_LOG_ERROR("Stream length %d < header length %d", l, p - b);
+        goto RetErr;
+    }
+
     if (frameCount > LS_MAX_FRAME_COUNT || frameCount == 0)
     {
         NRF_LOG_ERROR("Frame count %d is invalid", frameCount);
         goto RetErr;
     }
 
-    NRF_LOG_DEBUG("Stream length: %d", length);
+    NRF_LOG_DEBUG("Stream version: %d", idx);
+    NRF_LOG_DEBUG("Stream length: %d", l);
     NRF_LOG_DEBUG("Refresh period: %d", refresh);
     NRF_LOG_DEBUG("Frame count: %d", frameCount);
 
-    l -= 4;
-
-    curr_stream.refreshPeriod = refresh;
-    curr_stream.frameCount = frameCount;
+    info->length = l;
+    l -= p - b;
 
-    uint32_t byteCount = 0;     // total data bytes in last FRAME
-    for (frame = 0; frame < frameCount; frame++)
+    if (info->paletteSize != 0)
     {
-        uint8_t format;
-        uint16_t duration;
-        uint16_t repeat;
-        uint8_t row, rowCount;
-        uint8_t ledCount;
-
-        //          - frame header:
-        //              - frame duration - 2 bytes (in refresh periods)
-        //              - frame repeat count - 2 bytes
-        //              - frame format - 1 byte (ls_frame_Invalid+1..ls_frame_FormatMax-1)
+        //      - palette size - 1 byte (1..255, 0 means LS_MAX_PALETTE_SIZE)
+        //      - color values - 3 bytes RR GG BB each
 
-        if (l < 5)
+        if (l < 1)
         {
-            NRF_LOG_ERROR("Stream is too short - incomplete header of frame %d", frame);
+            NRF_LOG_ERROR("Stream is too short - no palette size");
             goto RetErr;
         }
 
-        duration = *p++;
-        duration += (uint16_t)(*p++) << 8;
-        l -= 2;
-
-        repeat = *p++;
-        repeat += (uint16_t)(*p++) << 8;
-        l -= 2;
-
-        format = *p++;
+        if (*p != 0)
+            info->paletteSize = *p;
+        p++;
         l--;
 
-        if (format > (ls_frame_FormatMax - 1) || format < (ls_frame_Invalid + 1))
+        if (l < (size_t)(info->paletteSize * 3))
         {
-            NRF_LOG_ERROR("Invalid format %d of frame %d", format, frame);
+            NRF_LOG_ERROR("Stream is too short - incomplete palette of %d colors", info->paletteSize);
             goto RetErr;
         }
 
-        curr_stream.frame[frame].duration = duration;
-        curr_stream.frame[frame].repeat = repeat;
-        curr_stream.frame[frame].format = format;
-        curr_stream.frame[frame].offset = p - b;
-
-        NRF_LOG_DEBUG("Frame %d:", frame);
-        NRF_LOG_DEBUG("  Duration: %d", duration);
-        NRF_LOG_DEBUG("    Repeat: %d", repeat);
-        NRF_LOG_DEBUG("    Format: %d", format);
-        NRF_LOG_DEBUG("    Offset: %d", curr_stream.frame[frame].offset);
-
-        switch (format)
-        {
-        case ls_frame_Base:
-        {
-            //                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
-            //                  - row 0 data:
-            //                      - led count - 1 byte (1..LS_MAX_LED_COUNT) 
-            //                      - led 0 value - 3bytes RR GG BB
-            //                      - led 1 value
-            //                      - led ...
-            //                  - row 1 data:
-            //                      - led count
-            //                      - ...
-
-            byteCount = 0;
-
-            if (l < 5)
-            {
-                NRF_LOG_ERROR("Stream is too short - no row count in frame %d", frame);
-                goto RetErr;
-            }
-
-            rowCount = *p++;
-            l--;
-
-            if (rowCount > LS_MAX_ROW_COUNT || rowCount == 0)
-            {
-                NRF_LOG_ERROR("Row count %d in frame %d is invalid", rowCount, frame);
-                goto RetErr;
-            }
-
-            NRF_LOG_DEBUG("  Format: FRAME");
-            NRF_LOG_DEBUG("  Row count: %d", rowCount);
-
-            for (row = 0; row < rowCount; row++)
-            {
-                if (l < 1)
-                {
-                    NRF_LOG_ERROR("Stream is too short - no led count in row %d on frame %d", row, frame);
-                    goto RetErr;
-                }
-
-                ledCount = *p++;
-                l--;
-
-                if (ledCount > LS_MAX_LED_COUNT || ledCount == 0)
-                {
-                    NRF_LOG_ERROR("Led count %d in row %d of frame %d is invalid, allowed 1..%d", ledCount, row, frame, LS_MAX_LED_COUNT);
-                    goto RetErr;
-                }
-
-                NRF_LOG_DEBUG("  Row %d  Led count: %d", row, ledCount);
-
-                if (l < (size_t)(ledCount * 3))
-                {
-                    NRF_LOG_ERROR("Stream is too short - incomplete led data in row %d of frame %d", row, frame);
-                    goto RetErr;
-                }
-
-                p += ledCount * 3;
-                l -= ledCount * 3;
+        info->palette = p;
+        p += info->paletteSize * 3;
+        l -= info->paletteSize * 3;
 
-                byteCount += ledCount * 3;
-            }
+        NRF_LOG_DEBUG("Palette size: %d", info->paletteSize);
+    }
 
-            break;
-        }
+    // frame header - duration, repeat count and format
+    if (l < 5)
+    {
+        NRF_LOG_ERROR("Stream is too short - no frame");
+        goto RetErr;
+    }
 
-        case ls_frame_Transition:
-        {
-            NRF_LOG_DEBUG("  Format: TRANSITION  byteCount %d", byteCount);
+    if (info->maxRowCount == 0)
+        info->maxRowCount = LS_MAX_ROW_COUNT;
+    if (info->maxLedCount == 0)
+        info->maxLedCount = LS_MAX_LED_COUNT;
 
-            if (l < byteCount)
-            {
-                NRF_LOG_ERROR("Stream is too short - %d bytes left, %d expected", l, byteCount);
-                goto RetErr;
-            }
+    NRF_LOG_DEBUG("Geometry limit: %d x %d", info->maxRowCount, info->maxLedCount);
 
-            p += byteCount;
-            l -= byteCount;
+    info->indexSize = idx;
+    info->refreshPeriod = refresh;
+    info->frameCount = frameCount;
 
-            break;
-        }
-        }
+    // only the first frame is known until playback gets further
+    memset(info->index, 0, sizeof(info->index));
+    info->indexStride = 1;
+    info->index[0].offset = p - b;
+    info->index[0].frame = 0;
+    info->index[0].base = LS_NO_FRAME;
 
-    }
+    info->timeCount = 0;
+    info->timeSpacing = 1;
+    info->timePeriod = 0;
+    info->timeIndexed = false;
+    info->baseWarned = false;
 
-    if (l > 3)
+#if LS_SNAPSHOT_MEMORY > 0
+    for (uint8_t i = 0; i < LS_SNAPSHOT_COUNT; i++)
     {
-        NRF_LOG_ERROR("Extra data (%d bytes) at the end of the stream", l);
-        goto RetErr;
+        if (snapshots[i].stream == info)
+            snapshots[i].stream = NULL;
     }
+#endif
+    info->snapshotHits = 0;
+    info->snapshotMisses = 0;
 
     status = NRF_SUCCESS;
 
@@ -253,202 +540,2309 @@ RetErr:
     return status;
 }
 
-static void streamNext(stream_info_t* s);
-
-static int streamStart(stream_info_t* s)
+// remember cursor if it is at an indexed frame
+static void indexAdd(stream_info_t* s, const stream_cursor_t* c)
 {
-    // reset current frame
-    s->frameNumber = 0;
-    s->frameDuration = 0;
-    s->frameRepeat = 0;
-
-    // calculate next frame
-    streamNext(s);
+    // when cursor gets past the last slot, drop every other indexed frame
+    while (c->frame >= s->indexStride * LS_CURSOR_INDEX_SIZE)
+    {
+        s->indexStride *= 2;
 
-    // TODO: start app timer
-    //  WdfTimerStart(deviceContext->refreshTimer, WDF_REL_TIMEOUT_IN_MS(GNKSPL_REFRESH_UNIT));
+        for (uint8_t i = 1; i < LS_CURSOR_INDEX_SIZE; i++)
+        {
+            if (i < (LS_CURSOR_INDEX_SIZE + 1) / 2)
+                s->index[i] = s->index[2 * i];
+            else
+                s->index[i].offset = 0;
+        }
+    }
 
-    return 0;
+    if (c->frame % s->indexStride == 0)
+        s->index[c->frame / s->indexStride] = *c;
 }
 
-static void streamNext(stream_info_t* s)
+static int streamSeek(stream_info_t* s, uint16_t frame, stream_cursor_t* c, uint8_t level);
+
+// parse and validate frame at cursor position, advance cursor to the next frame
+//  level is the number of seeks in progress for references
+static int frameParse(stream_info_t* s, stream_cursor_t* c, stream_frame_t* f, uint8_t level)
 {
-    NRF_LOG_DEBUG("frame %d  duration %d  repeat %d", s->frameNumber, s->frameDuration, s->frameRepeat);
+    int status = NRF_ERROR_INVALID_DATA;
+    const uint8_t* p = s->stream + c->offset;
+    uint32_t l = s->length - c->offset;
+    uint8_t idx = s->indexSize;
+    uint16_t frame = c->frame;
+    uint8_t format;
+    uint16_t duration;
+    uint16_t repeat;
+    uint8_t row, rowCount = 0;
+    uint16_t ledCount;
+    uint16_t baseLedCount[LS_MAX_ROW_COUNT];    // geometry defined by this frame
 
-    // select current step
-    stream_frame_t * frame = &s->frame[s->frameNumber];
+    uint32_t byteCount = 0;     // total data bytes in last FRAME
+    for (row = 0; row < c->rowCount; row++)
+        byteCount += (uint32_t)c->ledCount[row] * 3;
 
-    // if duration counter not yet expired, do not recalculate 
-    if (s->frameDuration > 0 && s->frameDuration++ < frame->duration)
-        return;
+    indexAdd(s, c);
 
-    // reset duration counter
-    s->frameDuration = 1;
+    //          - frame header:
+    //              - frame duration - 2 bytes (in refresh periods)
+    //              - frame repeat count - 2 bytes
+    //              - frame format - 1 byte (ls_frame_Invalid+1..ls_frame_FormatMax-1)
 
-    // if repeat counter expired, go to next step
-    //  note that next step will be selected on next refresh
-    if (s->frameRepeat >= frame->repeat)
+    if (l < 5)
     {
-        s->frameRepeat = 0;
-
-        s->frameNumber++;
-        if (s->frameNumber >= s->frameCount)
-            s->frameNumber = 0;
+        NRF_LOG_ERROR("Stream is too short - incomplete header of frame %d", frame);
+        goto RetErr;
     }
 
-    // update repeat counter
-    s->frameRepeat++;
-
-    // recalculate frame
-    uint32_t* oldFrame;
-    uint32_t* newFrame;
+    duration = *p++;
+    duration += (uint16_t)(*p++) << 8;
+    l -= 2;
 
-    oldFrame = s->currFrame;
-    if (oldFrame == NULL || oldFrame == s->showFrame2)
-        newFrame = s->showFrame2;
-    else
-        newFrame = s->showFrame1;
+    repeat = *p++;
+    repeat += (uint16_t)(*p++) << 8;
+    l -= 2;
 
-    // locate step data
-    const uint8_t* p = s->stream + frame->offset;
+    format = *p++;
+    l--;
 
-    uint8_t rowCount = 0;
-    uint8_t ledCount[LS_MAX_ROW_COUNT];
+    if (format > (ls_frame_FormatMax - 1) || format < (ls_frame_Invalid + 1))
+    {
+        NRF_LOG_ERROR("Invalid format %d of frame %d", format, frame);
+        goto RetErr;
+    }
 
-    switch (frame->format)
+    f->number = frame;
+    f->duration = duration;
+    f->repeat = repeat;
+    f->format = format;
+    f->data = p;
+    f->base = c->base;
+    f->link = LS_NO_FRAME;
+
+    NRF_LOG_DEBUG("Frame %d:", frame);
+    NRF_LOG_DEBUG("  Duration: %d", duration);
+    NRF_LOG_DEBUG("    Repeat: %d", repeat);
+    NRF_LOG_DEBUG("    Format: %d", format);
+    NRF_LOG_DEBUG("    Offset: %d", p - s->stream);
+
+    switch (format)
     {
     case ls_frame_Base:
+    case ls_frame_Index8:
+    case ls_frame_Index4:
+    case ls_frame_Index2:
     {
-        // only calculate on very first repetition
-//        if (deviceContext->stepRepeat != 1)
-//            break;
+        //                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+        //                  - row 0 data:
+        //                      - led count - 1 byte (1..LS_MAX_LED_COUNT) 
+        //                      - led 0 value - 3bytes RR GG BB
+        //                      - led 1 value
+        //                      - led ...
+        //                  - row 1 data:
+        //                      - led count
+        //                      - ...
+        //              palette formats store 8, 4 or 2 bit palette index instead of led value
+
+        uint8_t bits = ledBits(format);
+
+        if (bits < 24 && s->paletteSize == 0)
+        {
+            NRF_LOG_ERROR("Frame %d uses palette format but stream has no palette", frame);
+            goto RetErr;
+        }
+
+        if (l < 5)
+        {
+            NRF_LOG_ERROR("Stream is too short - no row count in frame %d", frame);
+            goto RetErr;
+        }
 
         rowCount = *p++;
+        l--;
 
-        NRF_LOG_DEBUG("Base  row count %d", rowCount);
-        
-        for (uint8_t row = 0; row < rowCount; row++)
+        if (rowCount > s->maxRowCount || rowCount == 0)
         {
-            uint32_t* r = newFrame + row * LS_MAX_LED_COUNT;
-            ledCount[row] = *p++;
+            NRF_LOG_ERROR("Row count %d in frame %d is invalid, allowed 1..%d", rowCount, frame, s->maxRowCount);
+            goto RetErr;
+        }
 
-            for (uint8_t led = 0; led < ledCount[row]; led++)
-            {
-                uint8_t R = *p++;
-                uint8_t G = *p++;
-                uint8_t B = *p++;
+        NRF_LOG_DEBUG("  Format: FRAME");
+        NRF_LOG_DEBUG("  Row count: %d", rowCount);
 
-                r[led] = ((uint32_t)G << 16) | ((uint32_t)R << 8) | ((uint32_t)B << 0);
+        for (row = 0; row < rowCount; row++)
+        {
+            if (l < idx)
+            {
+                NRF_LOG_ERROR("Stream is too short - no led count in row %d on frame %d", row, frame);
+                goto RetErr;
             }
-        }
 
-        break;
-    }
+            ledCount = getIndex(&p, idx);
+            l -= idx;
 
-    case ls_frame_Transition:
-    {
-        if (oldFrame == NULL)
-            break;
+            if (ledCount > s->maxLedCount || ledCount == 0)
+            {
+                NRF_LOG_ERROR("Led count %d in row %d of frame %d is invalid, allowed 1..%d", ledCount, row, frame, s->maxLedCount);
+                goto RetErr;
+            }
 
-        rowCount = s->currRowCount;
-        memcpy(ledCount, s->currLedCount, sizeof(ledCount));
+            NRF_LOG_DEBUG("  Row %d  Led count: %d", row, ledCount);
 
-        NRF_LOG_DEBUG("Transition  row count %d", rowCount);
+            baseLedCount[row] = ledCount;
 
-        for (uint8_t row = 0; row < rowCount; row++)
-        {
-            uint32_t* lr = oldFrame + row * LS_MAX_LED_COUNT;
-            uint32_t* nr = newFrame + row * LS_MAX_LED_COUNT;
+            size_t rowBytes = ((uint32_t)ledCount * bits + 7) / 8;
 
-            for (uint8_t led = 0; led < ledCount[row]; led++)
+            if (l < rowBytes)
             {
-                uint32_t l = lr[led];
-
-                uint8_t R = (l >> 8) & 0xFF;
-                uint8_t G = (l >> 16) & 0xFF;
-                uint8_t B = (l >> 0) & 0xFF;
+                NRF_LOG_ERROR("Stream is too short - incomplete led data in row %d of frame %d", row, frame);
+                goto RetErr;
+            }
 
-                R += (int8_t)(*p++);
-                G += (int8_t)(*p++);
-                B += (int8_t)(*p++);
+            if (bits < 24)
+            {
+                uint8_t mask = (1 << bits) - 1;
+                uint8_t shift = 0;
+                uint8_t v = 0;
 
-                nr[led] = ((uint32_t)G << 16) | ((uint32_t)R << 8) | ((uint32_t)B << 0);
+                for (uint16_t led = 0; led < ledCount; led++)
+                {
+                    if (shift == 0)
+                    {
+                        v = *p++;
+                        shift = 8;
+                    }
+                    shift -= bits;
+
+                    if (((v >> shift) & mask) >= s->paletteSize)
+                    {
+                        NRF_LOG_ERROR("Palette index %d of led %d in row %d of frame %d is invalid",
+                            (v >> shift) & mask, led, row, frame);
+                        goto RetErr;
+                    }
+                }
+            }
+            else
+            {
+                p += rowBytes;
             }
+            l -= rowBytes;
         }
 
         break;
     }
 
-    default:
-        NRF_LOG_ERROR("Invalid frame format %d", frame->format);
-        break;
-    }
-
-    // set frame to show 
-    s->currFrame = newFrame;
-    s->currRowCount = rowCount;
-    if (s->currRow >= rowCount)
-        s->currRow = 0;
-    memcpy(s->currLedCount, ledCount, sizeof(ledCount));
-}
-
-#if 0
-static void streamStop(stream_info_t* s)
-{
-    s->currFrame = NULL;
-    s->currRow = 0;
-}
-#endif
-
-static void streamRefresh(stream_info_t* s)
-{
-    uint32_t* frame;
-    uint8_t ledCount;
-    int ri;
- 
-    frame = s->currFrame;
-    ri = s->currRow;
-    ledCount = s->currLedCount[ri];
-
-    if (frame == NULL)
-        return;
+    case ls_frame_Transition:
+    {
+        NRF_LOG_DEBUG("  Format: TRANSITION  byteCount %d", byteCount);
 
-    // output current row
-    uint32_t* row = frame + ri * LS_MAX_LED_COUNT;
+        if (l < byteCount)
+        {
+            NRF_LOG_ERROR("Stream is too short - %d bytes left, %d expected", l, byteCount);
+            goto RetErr;
+        }
 
-    led_ctlr->show(led_ctlr, ri, row, ledCount);
+        p += byteCount;
+        l -= byteCount;
 
-    if (++s->currRow >= s->currRowCount)
-        s->currRow = 0;
+        break;
+    }
 
-    if (++s->currRefresh >= s->refreshPeriod)
+    case ls_frame_Gradient:
+    {
+        //                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+        //                  - row data:
+        //                      - led count - 1 byte (1..LS_MAX_LED_COUNT)
+        //                      - stop count - 1 byte (1..led count)
+        //                      - stops: led index - 1 byte, color value - 3 bytes RR GG BB
+        //              counts and led indices are 2 bytes in v2 stream
+
+        if (l < 1)
+        {
+            NRF_LOG_ERROR("Stream is too short - no row count in frame %d", frame);
+            goto RetErr;
+        }
+
+        rowCount = *p++;
+        l--;
+
+        if (rowCount > s->maxRowCount || rowCount == 0)
+        {
+            NRF_LOG_ERROR("Row count %d in frame %d is invalid, allowed 1..%d", rowCount, frame, s->maxRowCount);
+            goto RetErr;
+        }
+
+        NRF_LOG_DEBUG("  Format: GRADIENT");
+        NRF_LOG_DEBUG("  Row count: %d", rowCount);
+
+        for (row = 0; row < rowCount; row++)
+        {
+            uint16_t stopCount;
+
+            if (l < 2 * idx)
+            {
+                NRF_LOG_ERROR("Stream is too short - no led or stop count in row %d on frame %d", row, frame);
+                goto RetErr;
+            }
+
+            ledCount = getIndex(&p, idx);
+            stopCount = getIndex(&p, idx);
+            l -= 2 * idx;
+
+            if (ledCount > s->maxLedCount || ledCount == 0)
+            {
+                NRF_LOG_ERROR("Led count %d in row %d of frame %d is invalid, allowed 1..%d", ledCount, row, frame, s->maxLedCount);
+                goto RetErr;
+            }
+
+            if (stopCount > ledCount || stopCount == 0)
+            {
+                NRF_LOG_ERROR("Stop count %d in row %d of frame %d is invalid, allowed 1..%d", stopCount, row, frame, ledCount);
+                goto RetErr;
+            }
+
+            NRF_LOG_DEBUG("  Row %d  Led count: %d  Stop count: %d", row, ledCount, stopCount);
+
+            if (l < (uint32_t)stopCount * (idx + 3))
+            {
+                NRF_LOG_ERROR("Stream is too short - incomplete stops in row %d of frame %d", row, frame);
+                goto RetErr;
+            }
+
+            uint16_t prev = 0;
+            for (uint16_t stop = 0; stop < stopCount; stop++)
+            {
+                uint16_t led = getIndex(&p, idx);
+
+                if (led >= ledCount || (stop > 0 && led <= prev))
+                {
+                    NRF_LOG_ERROR("Stop %d led index %d in row %d of frame %d is invalid", stop, led, row, frame);
+                    goto RetErr;
+                }
+
+                prev = led;
+                p += 3;
+            }
+
+            l -= (uint32_t)stopCount * (idx + 3);
+
+            baseLedCount[row] = ledCount;
+        }
+
+        break;
+    }
+
+    case ls_frame_Program:
+    case ls_frame_Effect:
+    {
+        //                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+        //                  - led count of each row - 1 byte (1..LS_MAX_LED_COUNT)
+        //              Program:
+        //                  - program length - 2 bytes LE (1..LS_VM_MAX_PROGRAM)
+        //                  - program
+        //              Effect:
+        //                  - effect - 1 byte
+        //                  - parameter length - 1 byte
+        //                  - parameters
+        //              led counts are 2 bytes in v2 stream
+
+        uint32_t totalLedCount = 0;
+        uint16_t dataLength;
+
+        if (l < 1)
+        {
+            NRF_LOG_ERROR("Stream is too short - no row count in frame %d", frame);
+            goto RetErr;
+        }
+
+        rowCount = *p++;
+        l--;
+
+        if (rowCount > s->maxRowCount || rowCount == 0)
+        {
+            NRF_LOG_ERROR("Row count %d in frame %d is invalid, allowed 1..%d", rowCount, frame, s->maxRowCount);
+            goto RetErr;
+        }
+
+        NRF_LOG_DEBUG("  Row count: %d", rowCount);
+
+        if (l < (uint32_t)rowCount * idx + 2)
+        {
+            NRF_LOG_ERROR("Stream is too short - no led counts or data length in frame %d", frame);
+            goto RetErr;
+        }
+
+        for (row = 0; row < rowCount; row++)
+        {
+            ledCount = getIndex(&p, idx);
+
+            if (ledCount > s->maxLedCount || ledCount == 0)
+            {
+                NRF_LOG_ERROR("Led count %d in row %d of frame %d is invalid, allowed 1..%d", ledCount, row, frame, s->maxLedCount);
+                goto RetErr;
+            }
+
+            NRF_LOG_DEBUG("  Row %d  Led count: %d", row, ledCount);
+
+            baseLedCount[row] = ledCount;
+            totalLedCount += ledCount;
+        }
+
+        l -= (uint32_t)rowCount * idx;
+
+        if (format == ls_frame_Program)
+        {
+            dataLength = *p++;
+            dataLength += (uint16_t)(*p++) << 8;
+            l -= 2;
+
+            NRF_LOG_DEBUG("  Format: PROGRAM  length %d", dataLength);
+
+            if (l < dataLength)
+            {
+                NRF_LOG_ERROR("Stream is too short - incomplete program in frame %d", frame);
+                goto RetErr;
+            }
+
+            if (led_vm_verify(p, dataLength, totalLedCount, s->paletteSize) != NRF_SUCCESS)
+            {
+                NRF_LOG_ERROR("Program of frame %d is invalid", frame);
+                goto RetErr;
+            }
+        }
+        else
+        {
+            uint8_t effect = *p++;
+            dataLength = *p++;
+            l -= 2;
+
+            NRF_LOG_DEBUG("  Format: EFFECT %d", effect);
+
+            if (l < dataLength)
+            {
+                NRF_LOG_ERROR("Stream is too short - incomplete effect parameters in frame %d", frame);
+                goto RetErr;
+            }
+
+            if (led_fx_verify(effect, p, dataLength) != NRF_SUCCESS)
+            {
+                NRF_LOG_ERROR("Effect of frame %d is invalid", frame);
+                goto RetErr;
+            }
+        }
+
+        p += dataLength;
+        l -= dataLength;
+
+        break;
+    }
+
+    case ls_frame_Reference:
+    {
+        //                  - referenced frame number - 1 byte
+
+        if (l < idx)
+        {
+            NRF_LOG_ERROR("Stream is too short - no referenced frame in frame %d", frame);
+            goto RetErr;
+        }
+
+        uint16_t target = getIndex(&p, idx);
+        l -= idx;
+
+        NRF_LOG_DEBUG("  Format: REFERENCE  frame %d", target);
+
+        if (target >= frame)
+        {
+            NRF_LOG_ERROR("Frame %d references frame %d which is not an earlier base frame", frame, target);
+            goto RetErr;
+        }
+
+        if (level >= LS_MAX_SEEK_DEPTH)
+        {
+            NRF_LOG_ERROR("Frame %d reference can not be resolved, too many nested references", frame);
+            goto RetErr;
+        }
+
+        stream_cursor_t t;
+        stream_frame_t tf;
+
+        if (streamSeek(s, target, &t, level + 1) != NRF_SUCCESS)
+            goto RetErr;
+
+        // format byte follows duration and repeat
+        uint8_t targetFormat = s->stream[t.offset + 4];
+        if (!isBase(targetFormat) || targetFormat == ls_frame_Reference)
+        {
+            NRF_LOG_ERROR("Frame %d references frame %d which is not an earlier base frame", frame, target);
+            goto RetErr;
+        }
+
+        if (frameParse(s, &t, &tf, level + 1) != NRF_SUCCESS)
+            goto RetErr;
+
+        // frame is calculated from the referenced frame data
+        f->format = tf.format;
+        f->data = tf.data;
+
+        rowCount = t.rowCount;
+        memcpy(baseLedCount, t.ledCount, sizeof(baseLedCount));
+
+        break;
+    }
+
+    case ls_frame_Sparse:
+    {
+        //                  - entry count - 2 bytes LE
+        //                  - entry: row - 1 byte, led - 1 byte (2 bytes in v2), led update - 3 bytes
+
+        uint16_t entryCount;
+        uint8_t entrySize = 1 + idx + 3;
+
+        if (l < 2)
+        {
+            NRF_LOG_ERROR("Stream is too short - no entry count in frame %d", frame);
+            goto RetErr;
+        }
+
+        entryCount = *p++;
+        entryCount += (uint16_t)(*p++) << 8;
+        l -= 2;
+
+        NRF_LOG_DEBUG("  Format: SPARSE  entryCount %d", entryCount);
+
+        if (l < (uint32_t)entryCount * entrySize)
+        {
+            NRF_LOG_ERROR("Stream is too short - %d bytes left, %d expected", l, entryCount * entrySize);
+            goto RetErr;
+        }
+
+        for (uint16_t entry = 0; entry < entryCount; entry++)
+        {
+            row = *p++;
+            uint16_t led = getIndex(&p, idx);
+            if (row >= c->rowCount || led >= c->ledCount[row])
+            {
+                NRF_LOG_ERROR("Led %d in row %d of frame %d is not in the last Base", led, row, frame);
+                goto RetErr;
+            }
+            p += 3;
+        }
+        l -= (uint32_t)entryCount * entrySize;
+
+        break;
+    }
+
+    case ls_frame_Shift:
+    {
+        //                  - row mask - 1 byte
+        //                  - shift - 1 signed byte (2 bytes in v2)
+        //                  - mode - 1 byte
+        //                  - fill value - 3 bytes RR GG BB
+
+        NRF_LOG_DEBUG("  Format: SHIFT");
+
+        if (l < 5u + idx)
+        {
+            NRF_LOG_ERROR("Stream is too short - incomplete shift in frame %d", frame);
+            goto RetErr;
+        }
+
+        if (p[0] >> c->rowCount)
+        {
+            NRF_LOG_ERROR("Row mask 0x%02x of frame %d selects rows not in the last Base", p[0], frame);
+            goto RetErr;
+        }
+
+        if (p[1 + idx] >= ls_shift_ModeMax)
+        {
+            NRF_LOG_ERROR("Invalid shift mode %d in frame %d", p[1 + idx], frame);
+            goto RetErr;
+        }
+
+        p += 5 + idx;
+        l -= 5 + idx;
+
+        break;
+    }
+
+    case ls_frame_LoopStart:
+    {
+        NRF_LOG_DEBUG("  Format: LOOP START  depth %d", c->depth);
+
+        if (c->depth >= LS_MAX_LOOP_DEPTH)
+        {
+            NRF_LOG_ERROR("Loop in frame %d is nested too deep, allowed %d levels", frame, LS_MAX_LOOP_DEPTH);
+            goto RetErr;
+        }
+
+        c->depth++;
+
+        break;
+    }
+
+    case ls_frame_LoopEnd:
+    {
+        NRF_LOG_DEBUG("  Format: LOOP END");
+
+        if (c->depth == 0)
+        {
+            NRF_LOG_ERROR("Loop end in frame %d without loop start", frame);
+            goto RetErr;
+        }
+
+        c->depth--;
+
+        break;
+    }
+
+    case ls_frame_Spawn:
+    {
+        //                  - particle count - 1 byte
+        //                  - row - 1 byte
+        //                  - position - 1 byte (2 bytes in v2)
+        //                  - velocity, velocity spread - 2 bytes LE each
+        //                  - acceleration - 1 byte
+        //                  - lifetime - 2 bytes LE
+        //                  - color - 3 bytes RR GG BB
+        //                  - decay - 1 byte
+
+        if (l < 13 + idx)
+        {
+            NRF_LOG_ERROR("Stream is too short - incomplete particles in frame %d", frame);
+            goto RetErr;
+        }
+
+        uint8_t count = p[0];
+        uint8_t prow = p[1];
+        p += 2;
+        uint16_t pos = getIndex(&p, idx);
+        uint16_t life = p[5] | ((uint16_t)p[6] << 8);
+        p += 11;
+        l -= 13 + idx;
+
+        NRF_LOG_DEBUG("  Format: SPAWN  count %d  row %d  position %d", count, prow, pos);
+
+        if (count == 0 || prow >= LS_MAX_ROW_COUNT || pos >= LS_MAX_LED_COUNT || life == 0)
+        {
+            NRF_LOG_ERROR("Particles in frame %d are invalid", frame);
+            goto RetErr;
+        }
+
+        break;
+    }
+
+    case ls_frame_Jump:
+    {
+        //                  - target frame number - 1 byte (2 bytes in v2)
+
+        if (l < idx)
+        {
+            NRF_LOG_ERROR("Stream is too short - no target in frame %d", frame);
+            goto RetErr;
+        }
+
+        f->link = getIndex(&p, idx);
+        l -= idx;
+
+        NRF_LOG_DEBUG("  Format: JUMP  target %d", f->link);
+
+        if (f->link >= s->frameCount)
+        {
+            NRF_LOG_ERROR("Jump target %d of frame %d is invalid", f->link, frame);
+            goto RetErr;
+        }
+
+        break;
+    }
+    }
+
+    if (isBase(format))
+    {
+        c->base = frame;
+        c->rowCount = rowCount;
+        memcpy(c->ledCount, baseLedCount, sizeof(baseLedCount));
+    }
+
+    c->offset = p - s->stream;
+    c->frame++;
+
+    status = NRF_SUCCESS;
+
+RetErr:
+    return status;
+}
+
+// position cursor at frame, starting from the closest indexed frame
+static int streamSeek(stream_info_t* s, uint16_t frame, stream_cursor_t* c, uint8_t level)
+{
+    uint32_t slot = frame / s->indexStride;
+    stream_frame_t f;
+
+    if (slot >= LS_CURSOR_INDEX_SIZE)
+        slot = LS_CURSOR_INDEX_SIZE - 1;
+
+    // first frame is always indexed
+    while (s->index[slot].offset == 0)
+        slot--;
+
+    *c = s->index[slot];
+
+    while (c->frame < frame)
+    {
+        int status = frameParse(s, c, &f, level);
+        if (status != NRF_SUCCESS)
+            return status;
+    }
+
+    return NRF_SUCCESS;
+}
+
+// move cursor after Jump frame to the jump target
+static int streamJump(stream_info_t* s, stream_cursor_t* c, uint16_t target)
+{
+    int status;
+    uint8_t depth = c->depth;       // loops containing both the jump and the target
+    stream_frame_t f;
+
+    if (target < c->frame)
+    {
+        status = streamSeek(s, target, c, 0);
+        if (status != NRF_SUCCESS)
+            return status;
+
+        // loops starting at or after the target are left
+        while (depth > 0 && s->state.loop[depth - 1].start.frame > target)
+            depth--;
+    }
+    else
+    {
+        // loops ending before the target are left
+        while (c->frame < target)
+        {
+            status = frameParse(s, c, &f, 0);
+            if (status != NRF_SUCCESS)
+                return status;
+
+            if (c->depth < depth)
+                depth = c->depth;
+        }
+    }
+
+    if (c->depth != depth)
+    {
+        NRF_LOG_ERROR("Jump to frame %d enters loop body", target);
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    return NRF_SUCCESS;
+}
+
+// add particles described by Spawn frame
+static void streamSpawn(stream_info_t* s, const stream_frame_t* frame)
+{
+    const uint8_t* p = frame->data;
+    led_particle_spawn_t spawn;
+
+    // frame was validated by frameParse
+    spawn.count = *p++;
+    spawn.row = *p++;
+    spawn.pos = (int32_t)getIndex(&p, s->indexSize) << 16;
+    spawn.vel = (int32_t)(int16_t)(p[0] | ((uint16_t)p[1] << 8)) << 8;
+    spawn.spread = (int32_t)(p[2] | ((uint16_t)p[3] << 8)) << 8;
+    spawn.accel = (int32_t)(int8_t)p[4] << 4;
+    spawn.life = p[5] | ((uint16_t)p[6] << 8);
+    spawn.color = PIXEL(p[7], p[8], p[9]);
+    spawn.decay = (uint16_t)p[10] << 4;
+
+    if (led_ctlr_spawn(&spawn) != NRF_SUCCESS)
+        NRF_LOG_DEBUG("Particles of frame %d dropped", frame->number);
+}
+
+static void streamNext(stream_info_t* s);
+
+// select frame to show, executing control frames on the way
+static void streamSelect(stream_info_t* s)
+{
+    stream_cursor_t* c = &s->state.next;
+    stream_frame_t f;
+
+    // without a frame to show, control frames can only revisit themselves
+    for (uint32_t count = 0; count <= s->frameCount; count++)
+    {
+        if (c->frame >= s->frameCount)
+        {
+            if (c->depth > 0)
+            {
+                NRF_LOG_ERROR("Loop starting in frame %d has no end", s->state.loop[c->depth - 1].start.frame - 1);
+                goto Halt;
+            }
+
+            if (s->length - c->offset > 3)
+            {
+                NRF_LOG_ERROR("Extra data (%d bytes) at the end of the stream", s->length - c->offset);
+                goto Halt;
+            }
+
+            *c = s->index[0];
+        }
+
+        if (frameParse(s, c, &f, 0) != NRF_SUCCESS)
+            goto Halt;
+
+        switch (f.format)
+        {
+        case ls_frame_LoopStart:
+            s->state.loop[c->depth - 1].start = *c;
+            s->state.loop[c->depth - 1].count = f.repeat;
+            s->state.loop[c->depth - 1].shown = s->state.shown;
+            break;
+
+        case ls_frame_LoopEnd:
+        {
+            stream_loop_t* loop = &s->state.loop[c->depth];
+
+            if (loop->shown == s->state.shown)
+            {
+                NRF_LOG_ERROR("Loop %d..%d contains no frame to show", loop->start.frame - 1, f.number);
+                goto Halt;
+            }
+
+            // loop count 0 repeats forever
+            if (loop->count == 0 || --loop->count > 0)
+                *c = loop->start;
+            break;
+        }
+
+        case ls_frame_Jump:
+            if (streamJump(s, c, f.link) != NRF_SUCCESS)
+                goto Halt;
+            break;
+
+        case ls_frame_Spawn:
+            // particles are not part of the stream position, seek does not restore them
+            if (!s->seeking)
+                streamSpawn(s, &f);
+            break;
+
+        default:
+            s->state.frame = f;
+            s->state.shown++;
+            return;
+        }
+    }
+
+    NRF_LOG_ERROR("Control frames at frame %d do not lead to a frame to show", c->frame);
+
+Halt:
+    s->state.halted = true;
+}
+
+// position before the first frame
+static void streamRewind(stream_info_t* s)
+{
+    s->state.time = 0;
+    s->state.frameDuration = 0;
+    s->state.frameRepeat = 0;
+    s->state.currBase = LS_NO_FRAME;
+    s->state.halted = false;
+    s->state.shown = 0;
+    s->state.next = s->index[0];
+    streamSelect(s);
+}
+
+static int streamStart(stream_info_t* s)
+{
+    // reset current frame
+    streamRewind(s);
+
+    // calculate next frame
+    streamNext(s);
+
+    // TODO: start app timer
+    //  WdfTimerStart(deviceContext->refreshTimer, WDF_REL_TIMEOUT_IN_MS(GNKSPL_REFRESH_UNIT));
+
+    return 0;
+}
+
+// copy frame and its geometry to another buffer
+static void bufferCopy(const stream_info_t* s, stream_buffer_t* to, const stream_buffer_t* from)
+{
+    if (to == from)
+        return;
+
+    to->rowCount = from->rowCount;
+    memcpy(to->ledCount, from->ledCount, sizeof(to->ledCount));
+    memcpy(to->rowStart, from->rowStart, sizeof(to->rowStart));
+
+    for (uint8_t row = 0; row < from->rowCount; row++)
+        memcpy(to->frame + row * s->maxLedCount, from->frame + row * s->maxLedCount, from->ledCount[row] * sizeof(led_ctlr_pixel_t));
+}
+
+// add differences of Sparse frame to frame buffer
+static void sparseApply(const stream_info_t* s, stream_buffer_t* buf, const uint8_t* p)
+{
+    uint8_t idx = s->indexSize;
+    uint16_t entryCount = p[0] | ((uint16_t)p[1] << 8);
+    p += 2;
+
+    NRF_LOG_DEBUG("Sparse  entry count %d", entryCount);
+
+    // entries were validated by parseStream
+    for (uint16_t entry = 0; entry < entryCount; entry++)
+    {
+        uint8_t row = *p++;
+        uint16_t i = buf->rowStart[row] + getIndex(&p, idx);
+        if (i >= buf->ledCount[row])
+            i -= buf->ledCount[row];
+
+        led_ctlr_pixel_t* px = buf->frame + row * s->maxLedCount + i;
+
+#if LS_PIXEL_PACKED
+        px->r += (int8_t)p[0];
+        px->g += (int8_t)p[1];
+        px->b += (int8_t)p[2];
+        p += 3;
+#else
+        uint32_t l = *px;
+
+        uint8_t R = (l >> 8) & 0xFF;
+        uint8_t G = (l >> 16) & 0xFF;
+        uint8_t B = (l >> 0) & 0xFF;
+
+        R += (int8_t)(*p++);
+        G += (int8_t)(*p++);
+        B += (int8_t)(*p++);
+
+        *px = PIXEL(R, G, B);
+#endif
+    }
+}
+
+// rotate rows of frame buffer by Shift frame
+//  start of the row ring buffer moves, fill only touches shifted in leds
+static void shiftApply(const stream_info_t* s, stream_buffer_t* buf, const uint8_t* p)
+{
+    uint8_t mask = *p++;
+    int16_t shift = (s->indexSize > 1) ? (int16_t)getIndex(&p, s->indexSize) : (int8_t)(*p++);
+    uint8_t mode = *p++;
+    uint32_t fill = PIXEL(p[0], p[1], p[2]);
+
+    NRF_LOG_DEBUG("Shift  mask 0x%02x  shift %d  mode %d", mask, shift, mode);
+
+    for (uint8_t row = 0; row < buf->rowCount; row++)
+    {
+        if ((mask & (1 << row)) == 0)
+            continue;
+
+        uint16_t n = buf->ledCount[row];
+        uint16_t k = (shift < 0 ? -shift : shift);  // number of leds shifted in
+        if (k > n)
+            k = n;
+
+        // led value at index 'led' moves to 'led + shift'
+        //  so the first led in the buffer moves 'shift' positions back
+        int32_t start = ((int32_t)buf->rowStart[row] - shift) % n;
+        if (start < 0)
+            start += n;
+        buf->rowStart[row] = start;
+
+        if (mode != ls_shift_Fill || k == 0)
+            continue;
+
+        led_ctlr_pixel_t* r = buf->frame + row * s->maxLedCount;
+        uint16_t i = (shift > 0) ? start : start + n - k;   // first shifted in led
+        for (uint16_t led = 0; led < k; led++, i++)
+        {
+            if (i >= n)
+                i -= n;
+            led_ctlr_pixel_set(&r[i], fill);
+        }
+    }
+}
+
+static void deltaApply(const stream_info_t* s, stream_buffer_t* buf, const stream_delta_t* d)
+{
+    if (d->format == ls_frame_Sparse)
+        sparseApply(s, buf, d->data);
+    else
+        shiftApply(s, buf, d->data);
+}
+
+// bring frame buffer up to the last calculated frame
+//  frames the buffer missed are applied again if all of them were Sparse or Shift, otherwise the frame is copied
+static void bufferSync(const stream_info_t* s, stream_buffer_t* buf, const stream_buffer_t* old)
+{
+    if (buf == old)
+        return;
+
+    if (buf->seq >= s->fullSeq && old->seq - buf->seq <= LS_DELTA_HISTORY)
+    {
+        for (uint32_t seq = buf->seq + 1; seq <= old->seq; seq++)
+            deltaApply(s, buf, &s->delta[seq % LS_DELTA_HISTORY]);
+    }
+    else
+        bufferCopy(s, buf, old);
+
+    buf->seq = old->seq;
+}
+
+// make calculated frame the latest one, continue in the buffer output does not use
+//  output may interrupt this at any point, the exchange is atomic
+static void streamPublish(stream_info_t* s)
+{
+    s->curr = &s->buffer[s->work];
+#if LS_SINGLE_BUFFER
+    // refresh timer calculated the frame in place, it is shown right away
+    s->shown = s->curr;
+    s->frameSeq++;
+#else
+    s->work = nrf_atomic_u32_fetch_store(&s->ready, s->work | LS_BUFFER_FRESH) & ~LS_BUFFER_FRESH;
+#endif
+}
+
+// show the latest frame if it was not shown yet
+//  compute cannot interrupt output, only this function clears LS_BUFFER_FRESH
+static void streamTake(stream_info_t* s)
+{
+#if !LS_SINGLE_BUFFER
+    if ((s->ready & LS_BUFFER_FRESH) == 0)
+        return;
+
+    s->shownBuffer = nrf_atomic_u32_fetch_store(&s->ready, s->shownBuffer) & ~LS_BUFFER_FRESH;
+    s->shown = &s->buffer[s->shownBuffer];
+    s->frameSeq++;
+#endif
+}
+
+// calculate frame to show
+static void streamRender(stream_info_t* s, const stream_frame_t* frame)
+{
+    // previous frame stays unchanged, it may be shown
+    stream_buffer_t* old = s->curr;
+    stream_buffer_t* buf = &s->buffer[s->work];
+    led_ctlr_pixel_t* oldFrame = (old != NULL) ? old->frame : NULL;
+    led_ctlr_pixel_t* newFrame = buf->frame;
+    uint16_t* rowStart = buf->rowStart;
+
+    LED_STACK_PROBE(led_stack_Compute);
+
+    // locate step data
+    const uint8_t* p = frame->data;
+
+    uint8_t rowCount = 0;
+    uint16_t ledCount[LS_MAX_ROW_COUNT];
+    uint8_t idx = s->indexSize;
+    stream_delta_t delta = { 0 };   // set for frames that change the previous one
+
+    switch (frame->format)
+    {
+    case ls_frame_Base:
+    {
+        // only calculate on very first repetition
+//        if (deviceContext->stepRepeat != 1)
+//            break;
+
+        rowCount = *p++;
+
+        NRF_LOG_DEBUG("Base  row count %d", rowCount);
+
+        memset(rowStart, 0, sizeof(buf->rowStart));
+        
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* r = newFrame + row * s->maxLedCount;
+            ledCount[row] = getIndex(&p, idx);
+
+            for (uint16_t led = 0; led < ledCount[row]; led++)
+            {
+                uint8_t R = *p++;
+                uint8_t G = *p++;
+                uint8_t B = *p++;
+
+                led_ctlr_pixel_set(&r[led], PIXEL(R, G, B));
+            }
+        }
+
+        break;
+    }
+
+    case ls_frame_Index8:
+    case ls_frame_Index4:
+    case ls_frame_Index2:
+    {
+        uint8_t bits = ledBits(frame->format);
+        uint8_t mask = (1 << bits) - 1;
+
+        rowCount = *p++;
+
+        NRF_LOG_DEBUG("Index%d  row count %d", bits, rowCount);
+
+        memset(rowStart, 0, sizeof(buf->rowStart));
+
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* r = newFrame + row * s->maxLedCount;
+            uint8_t shift = 0;
+            uint8_t v = 0;
+
+            ledCount[row] = getIndex(&p, idx);
+
+            // indices were validated by parseStream
+            for (uint16_t led = 0; led < ledCount[row]; led++)
+            {
+                if (shift == 0)
+                {
+                    v = *p++;
+                    shift = 8;
+                }
+                shift -= bits;
+
+                const uint8_t* c = s->palette + ((v >> shift) & mask) * 3;
+
+                led_ctlr_pixel_set(&r[led], PIXEL(c[0], c[1], c[2]));
+            }
+        }
+
+        break;
+    }
+
+    case ls_frame_Gradient:
+    {
+        rowCount = *p++;
+
+        NRF_LOG_DEBUG("Gradient  row count %d", rowCount);
+
+        memset(rowStart, 0, sizeof(buf->rowStart));
+
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* r = newFrame + row * s->maxLedCount;
+            uint16_t stopCount;
+
+            ledCount[row] = getIndex(&p, idx);
+            stopCount = getIndex(&p, idx);
+
+            // stops were validated by parseStream
+            gradientRow(rowWideGet(r), ledCount[row], stopCount, p, idx);
+            rowWidePut(r, ledCount[row]);
+            p += (uint32_t)stopCount * (idx + 3);
+        }
+
+        break;
+    }
+
+    case ls_frame_Program:
+    {
+        rowCount = *p++;
+
+        NRF_LOG_DEBUG("Program  row count %d", rowCount);
+
+        memset(rowStart, 0, sizeof(buf->rowStart));
+
+        for (uint8_t row = 0; row < rowCount; row++)
+            ledCount[row] = getIndex(&p, idx);
+
+        uint16_t codeLength = p[0] | ((uint16_t)p[1] << 8);
+        p += 2;
+
+        // random numbers depend on time only so the frame is the same when calculated again by seek
+        led_vm_ctx_t ctx =
+        {
+            .palette = s->palette,
+            .paletteSize = s->paletteSize,
+            .time = s->state.time,
+            .random = (s->state.time * 2654435761u) ^ frame->number,
+        };
+
+        // program was validated by parseStream
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* r = newFrame + row * s->maxLedCount;
+
+            led_vm_row(p, codeLength, &ctx, row, rowWideGet(r), ledCount[row]);
+            rowWidePut(r, ledCount[row]);
+        }
+
+        break;
+    }
+
+    case ls_frame_Effect:
+    {
+        rowCount = *p++;
+
+        memset(rowStart, 0, sizeof(buf->rowStart));
+
+        for (uint8_t row = 0; row < rowCount; row++)
+            ledCount[row] = getIndex(&p, idx);
+
+        uint8_t effect = *p++;
+        p++;
+
+        NRF_LOG_DEBUG("Effect %d  row count %d", effect, rowCount);
+
+        // effect was validated by parseStream
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* r = newFrame + row * s->maxLedCount;
+
+            led_fx_row(effect, p, s->state.time, row, rowWideGet(r), ledCount[row]);
+            rowWidePut(r, ledCount[row]);
+        }
+
+        break;
+    }
+
+    case ls_frame_Transition:
+    {
+        if (oldFrame == NULL)
+            break;
+
+        rowCount = old->rowCount;
+        memcpy(ledCount, old->ledCount, sizeof(ledCount));
+        if (buf != old)
+            memcpy(rowStart, old->rowStart, sizeof(buf->rowStart));
+
+        NRF_LOG_DEBUG("Transition  row count %d", rowCount);
+
+        for (uint8_t row = 0; row < rowCount; row++)
+        {
+            led_ctlr_pixel_t* lr = oldFrame + row * s->maxLedCount;
+            led_ctlr_pixel_t* nr = newFrame + row * s->maxLedCount;
+            uint16_t i = rowStart[row];     // buffer index of the led
+
+            for (uint16_t led = 0; led < ledCount[row]; led++, i++)
+            {
+                if (i >= ledCount[row])
+                    i = 0;
+
+#if LS_PIXEL_PACKED
+                nr[i].r = lr[i].r + (int8_t)p[0];
+                nr[i].g = lr[i].g + (int8_t)p[1];
+                nr[i].b = lr[i].b + (int8_t)p[2];
+                p += 3;
+#else
+                uint32_t l = lr[i];
+
+                uint8_t R = (l >> 8) & 0xFF;
+                uint8_t G = (l >> 16) & 0xFF;
+                uint8_t B = (l >> 0) & 0xFF;
+
+                R += (int8_t)(*p++);
+                G += (int8_t)(*p++);
+                B += (int8_t)(*p++);
+
+                nr[i] = PIXEL(R, G, B);
+#endif
+            }
+        }
+
+        break;
+    }
+
+    case ls_frame_Sparse:
+    case ls_frame_Shift:
+    {
+        if (oldFrame == NULL)
+            break;
+
+        // only listed or shifted in leds change, the buffer is brought up to the previous frame first
+        //  with LS_SINGLE_BUFFER it already holds the previous frame
+        bufferSync(s, buf, old);
+        rowCount = buf->rowCount;
+        memcpy(ledCount, buf->ledCount, sizeof(ledCount));
+
+        delta.format = frame->format;
+        delta.data = p;
+        deltaApply(s, buf, &delta);
+        break;
+    }
+
+    default:
+        NRF_LOG_ERROR("Invalid frame format %d", frame->format);
+        break;
+    }
+
+    // set frame to show 
+    buf->rowCount = rowCount;
+    memcpy(buf->ledCount, ledCount, sizeof(ledCount));
+    buf->seq = ++s->calcSeq;
+
+    if (delta.data != NULL)
+        s->delta[buf->seq % LS_DELTA_HISTORY] = delta;
+    else
+        s->fullSeq = buf->seq;
+
+    streamPublish(s);
+}
+
+// remember playback position after Base frame was calculated
+static void timeAdd(stream_info_t* s, const stream_frame_t* frame)
+{
+    // positions of repeating playback were indexed when the stream was loaded
+    if (!isBase(frame->format) || s->timePeriod > 0)
+        return;
+
+    if (s->timeCount > 0 && s->state.time < s->timeIndex[s->timeCount - 1].state.time + s->timeSpacing)
+        return;
+
+    // when the index is full, drop every other entry and double the spacing
+    if (s->timeCount >= LS_TIME_INDEX_SIZE)
+    {
+        for (uint8_t i = 1; i < (LS_TIME_INDEX_SIZE + 1) / 2; i++)
+            s->timeIndex[i] = s->timeIndex[2 * i];
+        s->timeCount = (LS_TIME_INDEX_SIZE + 1) / 2;
+        s->timeSpacing *= 2;
+
+        if (s->state.time < s->timeIndex[s->timeCount - 1].state.time + s->timeSpacing)
+            return;
+    }
+
+    s->timeIndex[s->timeCount].state = s->state;
+    s->timeIndex[s->timeCount].frame = *frame;
+    s->timeCount++;
+}
+
+#if LS_SNAPSHOT_MEMORY > 0
+// slot of k-th snapshot of a stream, consecutive snapshots of a stream use consecutive slots
+//  and each stream starts at a different slot
+static stream_snapshot_t* snapshotSlot(const stream_info_t* s, uint32_t k)
+{
+    return &snapshots[(k + (uint32_t)(s - streams) * LS_SNAPSHOT_COUNT / LS_MAX_STREAM_COUNT) % LS_SNAPSHOT_COUNT];
+}
+#endif
+
+// take snapshot of frame calculated by the last streamNext()
+static void snapshotAdd(stream_info_t* s)
+{
+#if LS_SNAPSHOT_MEMORY > 0
+    uint32_t time = s->state.time;
+
+    if (time == 0 || time % LS_SNAPSHOT_INTERVAL != 0 || s->curr == NULL)
+        return;
+
+    stream_snapshot_t* snap = snapshotSlot(s, time / LS_SNAPSHOT_INTERVAL);
+
+    if (snap->stream == s && snap->state.time == time)
+        return;
+
+    snap->stream = s;
+    snap->state = s->state;
+    snap->rowCount = s->curr->rowCount;
+    memcpy(snap->ledCount, s->curr->ledCount, sizeof(snap->ledCount));
+    memcpy(snap->rowStart, s->curr->rowStart, sizeof(snap->rowStart));
+
+    for (uint8_t row = 0; row < snap->rowCount; row++)
+        memcpy(snap->frame + row * LS_MAX_LED_COUNT, s->curr->frame + row * s->maxLedCount, snap->ledCount[row] * sizeof(led_ctlr_pixel_t));
+#endif
+}
+
+// find the latest snapshot taken at or before time and after 'after'
+static const stream_snapshot_t* snapshotFind(stream_info_t* s, uint32_t time, uint32_t after)
+{
+#if LS_SNAPSHOT_MEMORY > 0
+    uint32_t k = time / LS_SNAPSHOT_INTERVAL;
+
+    for (uint8_t i = 0; i < LS_SNAPSHOT_COUNT && k > 0 && k * LS_SNAPSHOT_INTERVAL > after; i++, k--)
+    {
+        const stream_snapshot_t* snap = snapshotSlot(s, k);
+
+        if (snap->stream == s && snap->state.time == k * LS_SNAPSHOT_INTERVAL)
+            return snap;
+    }
+#endif
+
+    return NULL;
+}
+
+// continue playback from snapshot
+static void snapshotRestore(stream_info_t* s, const stream_snapshot_t* snap)
+{
+    stream_buffer_t* buf = &s->buffer[s->work];
+
+    s->state = snap->state;
+    buf->rowCount = snap->rowCount;
+    memcpy(buf->ledCount, snap->ledCount, sizeof(buf->ledCount));
+    memcpy(buf->rowStart, snap->rowStart, sizeof(buf->rowStart));
+
+    for (uint8_t row = 0; row < snap->rowCount; row++)
+        memcpy(buf->frame + row * s->maxLedCount, snap->frame + row * LS_MAX_LED_COUNT, snap->ledCount[row] * sizeof(led_ctlr_pixel_t));
+
+    buf->seq = ++s->calcSeq;
+    s->fullSeq = buf->seq;
+    streamPublish(s);
+}
+
+// advance playback position by one refresh period
+//  returns false if the last calculated frame stays, otherwise 'frame' is the frame to calculate
+static bool streamStep(stream_info_t* s, stream_frame_t* frame)
+{
+    s->state.time++;
+
+    if (s->state.halted)
+        return false;
+
+    // select current step, selecting the next step below does not change it
+    *frame = s->state.frame;
+
+    // if duration counter not yet expired, do not recalculate 
+    if (s->state.frameDuration > 0 && s->state.frameDuration++ < frame->duration)
+        return false;
+
+    // reset duration counter
+    s->state.frameDuration = 1;
+
+    // if repeat counter expired, go to next step
+    //  note that next step will be selected on next refresh
+    if (s->state.frameRepeat >= frame->repeat)
+    {
+        s->state.frameRepeat = 0;
+
+        streamSelect(s);
+    }
+
+    // update repeat counter
+    s->state.frameRepeat++;
+
+    // frames that update previous frame only apply to the geometry they were validated against
+    if (isBase(frame->format))
+    {
+        s->state.currBase = frame->number;
+    }
+    else if (frame->base != s->state.currBase)
+    {
+        // the frame is skipped every time it comes round, seek and time index walks skip it too
+        if (!s->seeking && !s->baseWarned)
+        {
+            NRF_LOG_ERROR("Frame %d follows Base %d, expected Base %d", frame->number, s->state.currBase, frame->base);
+            s->baseWarned = true;
+        }
+        return false;
+    }
+
+    return true;
+}
+
+static void streamNext(stream_info_t* s)
+{
+    stream_frame_t frame;
+
+    NRF_LOG_DEBUG("frame %d  duration %d  repeat %d", s->state.frame.number, s->state.frameDuration, s->state.frameRepeat);
+
+    snapshotAdd(s);
+
+    if (!streamStep(s, &frame))
+        return;
+
+    streamRender(s, &frame);
+    timeAdd(s, &frame);
+}
+
+// advance playback position to 'time' without calculating frames
+//  'base' receives the position after the last Base frame on the way, returns false if there was none
+//  Base frames after the indexed part of playback extend the time index, the walk is not repeated
+static bool streamWalk(stream_info_t* s, uint32_t time, stream_time_t* base)
+{
+    stream_frame_t frame;
+    bool found = false;
+
+    while (s->state.time < time)
+    {
+        if (s->state.halted)
+        {
+            s->state.time = time;
+            break;
+        }
+
+        // frame duration passes at once
+        if (s->state.frameDuration > 0 && s->state.frameDuration < s->state.frame.duration)
+        {
+            uint32_t n = s->state.frame.duration - s->state.frameDuration;
+            if (n > time - s->state.time)
+                n = time - s->state.time;
+
+            s->state.time += n;
+            s->state.frameDuration += n;
+            continue;
+        }
+
+        if (streamStep(s, &frame) && isBase(frame.format))
+        {
+            base->state = s->state;
+            base->frame = frame;
+            found = true;
+            timeAdd(s, &frame);
+        }
+    }
+
+    return found;
+}
+
+// positions that continue the same way
+static bool stateSame(const stream_state_t* a, const stream_state_t* b)
+{
+    if (a->frame.number != b->frame.number || a->next.offset != b->next.offset || a->next.base != b->next.base ||
+        a->next.depth != b->next.depth || a->frameDuration != b->frameDuration || a->frameRepeat != b->frameRepeat ||
+        a->currBase != b->currBase || a->halted != b->halted)
+        return false;
+
+    for (uint8_t i = 0; i < a->next.depth; i++)
+    {
+        if (a->loop[i].start.offset != b->loop[i].start.offset || a->loop[i].count != b->loop[i].count)
+            return false;
+    }
+
+    return true;
+}
+
+// build time index on the first seek, frame headers are walked without calculating frames
+//  entries added by playback before are replaced, playback position is not kept
+//  positions after selected frames are compared with a saved one to find where playback repeats,
+//  the saved position is replaced after 1, 2, 4, ... frames (Brent's cycle detection)
+//  frames after the repeated position depend on the ones before it unless a Base frame is between them
+static void streamTimeIndex(stream_info_t* s)
+{
+    stream_state_t mark;        // saved position
+    bool markBase = false;      // Base frame was calculated after the saved position
+    uint32_t power = 1;         // frames between saved positions
+    uint32_t count = 0;         // frames since the saved position
+    uint32_t end = UINT32_MAX;  // walk ends one period after the repeated position
+    uint32_t period = 0;
+    stream_frame_t frame;
+
+    s->timeCount = 0;
+    s->timeSpacing = 1;
+    s->timePeriod = 0;
+    s->timeIndexed = true;
+
+    s->seeking = true;
+    streamRewind(s);
+    mark = s->state;
+
+    for (uint32_t n = 0; n < LS_TIME_WALK_LIMIT && s->state.time < end && !s->state.halted; n++)
+    {
+        if (s->state.frameDuration > 0 && s->state.frameDuration < s->state.frame.duration)
+        {
+            s->state.time += s->state.frame.duration - s->state.frameDuration;
+            s->state.frameDuration = s->state.frame.duration;
+        }
+
+        if (!streamStep(s, &frame))
+            continue;
+
+        if (isBase(frame.format))
+        {
+            timeAdd(s, &frame);
+            markBase = true;
+        }
+
+        // only positions right after frame selection are compared
+        if (period > 0 || s->state.frameRepeat != 1)
+            continue;
+
+        if (stateSame(&mark, &s->state))
+        {
+            if (!markBase)
+                break;
+
+            period = s->state.time - mark.time;
+            s->timeLoop = s->state.time;
+            end = s->state.time + period;
+        }
+        else if (++count == power)
+        {
+            mark = s->state;
+            markBase = false;
+            power *= 2;
+            count = 0;
+        }
+    }
+
+    if (period > 0 && s->state.time >= end)
+    {
+        s->timePeriod = period;
+        NRF_LOG_INFO("Stream repeats every %d refresh periods after %d, %d index entries", period, s->timeLoop, s->timeCount);
+    }
+    else if (!s->state.halted)
+        NRF_LOG_INFO("Stream time is indexed up to %d refresh periods", s->state.time);
+
+    s->seeking = false;
+}
+
+// continue playback at given time (number of streamNext() calls since stream start)
+//  time after the indexed period is mapped to the same position in it, frame headers are walked
+//  from the closest indexed Base to find the last Base before the time, frames after it are
+//  calculated again without output unless a later snapshot or the current position is closer
+static void streamSeekTime(stream_info_t* s, uint32_t time)
+{
+    uint32_t pos = time;        // same position in the indexed part of playback
+    stream_state_t curr = s->state;
+    stream_time_t base;
+    bool haveBase = false;
+
+    // stream starts without walking all of its frames, the walk is done when it is needed
+    if (!s->timeIndexed)
+    {
+        streamTimeIndex(s);
+        s->state = curr;
+    }
+
+    uint8_t i = s->timeCount;
+
+    if (s->timePeriod > 0 && time > s->timeLoop + s->timePeriod)
+        pos = s->timeLoop + 1 + (time - s->timeLoop - 1) % s->timePeriod;
+
+    s->seeking = true;
+
+    while (i > 0 && s->timeIndex[i - 1].state.time > pos)
+        i--;
+
+    if (i > 0)
+    {
+        base = s->timeIndex[i - 1];
+        s->state = base.state;
+        haveBase = true;
+    }
+    else
+        streamRewind(s);
+
+    if (streamWalk(s, pos, &base))
+        haveBase = true;
+
+    // Base frame, snapshot or current position closest to the time
+    uint32_t from = haveBase ? base.state.time + time - pos : 0;
+    const stream_snapshot_t* snap = snapshotFind(s, time, from);
+
+    if (snap != NULL && (curr.time > time || curr.time < snap->state.time || s->curr == NULL))
+    {
+        s->snapshotHits++;
+        snapshotRestore(s, snap);
+    }
+    else
+    {
+        s->snapshotMisses++;
+
+        if (curr.time <= time && curr.time > from && s->curr != NULL)
+        {
+            s->state = curr;
+        }
+        else if (haveBase)
+        {
+            s->state = base.state;
+            s->state.time += time - pos;
+            streamRender(s, &base.frame);
+        }
+        else
+        {
+            streamStart(s);
+        }
+    }
+
+    while (s->state.time < time)
+        streamNext(s);
+
+    s->seeking = false;
+}
+
+// no more frames are calculated or shown, the stream may be parsed again or its data may change
+//  called from thread mode, each step leaves nothing for the next refresh, take or compute to act on
+static void streamStop(stream_info_t* s)
+{
+    s->stream = NULL;
+    nrf_atomic_u32_and(&s->ready, ~LS_BUFFER_FRESH);
+    s->shown = NULL;
+    s->done = s->due;
+}
+
+// give buffers to compute and output, no frame is shown until one is calculated
+//  called while refresh timer is stopped
+static void streamBuffers(stream_info_t* s)
+{
+#if LS_SINGLE_BUFFER
+    s->work = 0;
+    s->ready = 0;
+    s->shownBuffer = 0;
+#else
+    s->work = 0;
+    s->ready = 1;
+    s->shownBuffer = 2;
+#endif
+    s->curr = NULL;
+    s->shown = NULL;
+    s->due = 0;
+    s->done = 0;
+
+    for (uint8_t b = 0; b < LS_STREAM_BUFFER_COUNT; b++)
+        s->buffer[b].seq = 0;
+    s->calcSeq = 0;
+    s->fullSeq = 0;
+}
+
+// request next frame when refresh period of the stream expires
+static void streamRefresh(stream_info_t* s)
+{
+    if (s->stream == NULL || s->shown == NULL)
+        return;
+
+    if (++s->currRefresh >= s->refreshPeriod)
     {
         s->currRefresh = 0;
+#if LS_SINGLE_BUFFER
+        // rows due in this refresh were already encoded, the frame can change under the rest
         streamNext(s);
+#else
+        s->due++;
+        NVIC_SetPendingIRQ(SWI3_EGU3_IRQn);
+#endif
+    }
+}
+
+// frames are calculated at the lowest interrupt priority, refresh timer output is never delayed by them
+//  frame that is not ready in time leaves the previous one shown, late frames are calculated
+//  back to back and only the latest one is shown so stream time does not fall behind
+#if !LS_SINGLE_BUFFER
+void SWI3_EGU3_IRQHandler(void)
+{
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+    {
+        stream_info_t* s = &streams[i];
+
+        while (s->stream != NULL && s->done != s->due)
+        {
+            s->done++;
+            streamNext(s);
+        }
+    }
+}
+#endif
+
+// give 'size' pixels of the arena to stream slot, buffers of the following streams are moved
+//  content of the slot buffers is not preserved
+static int arenaAlloc(uint8_t slot, uint32_t size)
+{
+    uint32_t used = 0;
+    uint32_t offset = 0;
+
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+    {
+        used += (i == slot) ? size : arenaSize[i];
+        if (i < slot)
+            offset += arenaSize[i];
+    }
+
+    if (used > sizeofarr(arena))
+    {
+        NRF_LOG_ERROR("Frame buffers need %d bytes, arena has %d", used * sizeof(led_ctlr_pixel_t), sizeof(arena));
+        return NRF_ERROR_NO_MEM;
+    }
+
+    int32_t shift = (int32_t)size - (int32_t)arenaSize[slot];
+
+    // move from the end when buffers grow, from the start when they shrink
+    for (uint8_t n = slot + 1; n < LS_MAX_STREAM_COUNT && shift != 0; n++)
+    {
+        uint8_t i = (shift > 0) ? LS_MAX_STREAM_COUNT + slot - n : n;
+        stream_info_t* s = &streams[i];
+
+        if (arenaSize[i] == 0)
+            continue;
+
+        memmove(s->buffer[0].frame + shift, s->buffer[0].frame, arenaSize[i] * sizeof(led_ctlr_pixel_t));
+        for (uint8_t b = 0; b < LS_STREAM_BUFFER_COUNT; b++)
+            s->buffer[b].frame += shift;
+    }
+
+    arenaSize[slot] = size;
+    for (uint8_t b = 0; b < LS_STREAM_BUFFER_COUNT; b++)
+        streams[slot].buffer[b].frame = arena + offset + b * (size / LS_STREAM_BUFFER_COUNT);
+
+    return NRF_SUCCESS;
+}
+
+// layer row pixels, ring buffer of 'count' pixels starting at 'start'
+//  frame buffer pixels if the row shows a stream, AAGGRRBB host pixels otherwise
+static const void* layerPixels(layer_t* l, uint8_t ri, uint16_t* count, uint16_t* start)
+{
+    layer_row_t* lr = &l->row[ri];
+    stream_info_t* s = lr->stream;
+
+    if (l->opacity == 0)
+        return NULL;
+
+    if (s == NULL)
+    {
+        *count = lr->hostCount;
+        *start = 0;
+        return lr->hostCount > 0 ? l->host + ri * LS_MAX_LED_COUNT : NULL;
+    }
+
+    if (s->shown == NULL || lr->row >= s->shown->rowCount)
+        return NULL;
+
+    *count = s->shown->ledCount[lr->row];
+    *start = s->shown->rowStart[lr->row];
+    return s->shown->frame + lr->row * s->maxLedCount;
+}
+
+static uint32_t layerSeq(const layer_row_t* lr)
+{
+    return lr->stream != NULL ? lr->stream->frameSeq : lr->hostSeq;
+}
+
+// d * s / 256 for each of three channels
+static uint32_t pixelMul(uint32_t d, uint32_t s)
+{
+    uint32_t p = 0;
+
+    for (uint8_t shift = 0; shift < 24; shift += 8)
+        p |= ((((d >> shift) & 0xFF) * (((s >> shift) & 0xFF) + 1)) >> 8) << shift;
+
+    return p;
+}
+
+// blend ring buffer of layer pixels into output row
+//  stream pixels have no alpha, they are opaque
+static void layerBlend(led_ctlr_pixel_t* out, const void* src, uint16_t count, uint16_t start,
+    led_ctlr_blend_t blend, uint16_t a, bool host)
+{
+    uint16_t i = start;
+
+    for (uint16_t led = 0; led < count; led++, i++)
+    {
+        if (i >= count)
+            i = 0;
+
+        uint32_t s = host ? ((const uint32_t*)src)[i] : led_ctlr_pixel_get((const led_ctlr_pixel_t*)src + i) | 0xFF000000;
+        uint32_t d = led_ctlr_pixel_get(&out[led]);
+        uint32_t sl = s & LED_PIXEL_LANES;
+        uint32_t sh = (s >> 8) & LED_PIXEL_LANES;
+        uint32_t dl = d & LED_PIXEL_LANES;
+        uint32_t dh = (d >> 8) & LED_PIXEL_LANES;
+
+        switch (blend)
+        {
+        case led_ctlr_blend_Replace:
+            dl = led_pixel_lanes_mix(dl, sl, a);
+            dh = led_pixel_lanes_mix(dh, sh, a);
+            break;
+
+        case led_ctlr_blend_Add:
+            dl = led_pixel_lanes_add(dl, sl, a);
+            dh = led_pixel_lanes_add(dh, sh, a);
+            break;
+
+        case led_ctlr_blend_Multiply:
+        {
+            uint32_t m = pixelMul(d, s);
+            dl = led_pixel_lanes_mix(dl, m & LED_PIXEL_LANES, a);
+            dh = led_pixel_lanes_mix(dh, (m >> 8) & LED_PIXEL_LANES, a);
+            break;
+        }
+
+        case led_ctlr_blend_Alpha:
+        {
+            uint16_t pa = s >> 24;
+            pa = ((pa + (pa >> 7)) * a) >> 8;
+            dl = led_pixel_lanes_mix(dl, sl, pa);
+            dh = led_pixel_lanes_mix(dh, sh, pa);
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        led_ctlr_pixel_set(&out[led], ((dh & 0xFF) << 8) | dl);
+    }
+}
+
+// compose layers and send the output row if any of its layers changed since it was sent
+static bool rowRefresh(uint8_t ri)
+{
+    bool dirty = rowDirty[ri];
+    uint8_t used = 0;
+    uint16_t len = 0;
+    uint8_t top = 0;
+    const void* px;
+    uint16_t count, start;
+
+    for (uint8_t li = 0; li < LS_MAX_LAYER_COUNT; li++)
+    {
+        layer_row_t* lr = &layers[li].row[ri];
+
+        if (layerPixels(&layers[li], ri, &count, &start) == NULL)
+            continue;
+
+        if (layerSeq(lr) != lr->frameSeq)
+            dirty = true;
+
+        used++;
+        top = li;
+        if (count > len)
+            len = count;
+    }
+
+    if (!dirty || used == 0)
+        return false;
+
+    rowDirty[ri] = false;
+
+    // single opaque stream layer is sent without composing
+    layer_t* l = &layers[top];
+    if (used == 1 && l->row[ri].stream != NULL && l->blend == led_ctlr_blend_Replace && l->opacity == 256)
+    {
+        px = layerPixels(l, ri, &count, &start);
+        l->row[ri].frameSeq = layerSeq(&l->row[ri]);
+        led_ctlr->show(led_ctlr, ri, px, count, start);
+        return true;
+    }
+
+    led_ctlr_pixel_t* out = rowOut + ri * LS_MAX_LED_COUNT;
+    memset(out, 0, len * sizeof(led_ctlr_pixel_t));
+
+    for (uint8_t li = 0; li < LS_MAX_LAYER_COUNT; li++)
+    {
+        l = &layers[li];
+        layer_row_t* lr = &l->row[ri];
+
+        px = layerPixels(l, ri, &count, &start);
+        if (px == NULL)
+            continue;
+
+        lr->frameSeq = layerSeq(lr);
+        layerBlend(out, px, count, start, l->blend, l->opacity, lr->stream == NULL);
+    }
+
+    led_ctlr->show(led_ctlr, ri, out, len, 0);
+
+    return true;
+}
+
+// move particles and draw them to host pixels of the particle layer
+//  particle row is as long as the longest row of other layers
+static void particleRefresh()
+{
+    uint16_t count, start;
+
+    led_particle_update();
+
+    if (particleLayer >= LS_MAX_LAYER_COUNT)
+        return;
+
+    layer_t* l = &layers[particleLayer];
+
+    for (uint8_t ri = 0; ri < LS_MAX_ROW_COUNT && ri < led_ctlr->rows; ri++)
+    {
+        layer_row_t* lr = &l->row[ri];
+        uint32_t* r = l->host + ri * LS_MAX_LED_COUNT;
+        uint16_t len = 0;
+
+        for (uint8_t li = 0; li < LS_MAX_LAYER_COUNT; li++)
+        {
+            if (li != particleLayer && layerPixels(&layers[li], ri, &count, &start) != NULL && count > len)
+                len = count;
+        }
+
+        memset(r, 0, len * sizeof(uint32_t));
+
+        if (led_particle_render(ri, r, len) > 0)
+        {
+            lr->hostCount = len;
+            lr->hostSeq++;
+        }
+        else if (lr->hostCount > 0)
+        {
+            // last particle left the row, the row is composed once more without it
+            lr->hostCount = 0;
+            rowDirty[ri] = true;
+        }
     }
 }
 
 void led_ctlr_task(void * p_context)
 {
-    streamRefresh(&curr_stream);
+    uint8_t sent = 0;
+
+    // frames calculated since the last refresh replace shown frames
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+        streamTake(&streams[i]);
+
+    particleRefresh();
+
+    // output changed rows, as many as the hw can update in one refresh
+    for (uint8_t n = 0; n < LS_MAX_ROW_COUNT && sent < led_ctlr->rows_per_refresh; n++)
+    {
+        if (rowRefresh(currRow))
+            sent++;
+
+        if (++currRow >= LS_MAX_ROW_COUNT)
+            currRow = 0;
+    }
+
+    // all streams advance on the same refresh tick, each with its own refresh period
+    //  next frames are calculated after the timer handler returns
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+        streamRefresh(&streams[i]);
 }
 
 static const uint8_t stream[] = LS_TEST_STREAM_0;
+static bool led_ctlr_running = false;
 
 int led_ctlr_init(led_ctlr_mode_t mode)
 {
     APP_ERROR_CHECK(app_timer_create(&led_task_timer, APP_TIMER_MODE_REPEATED, led_ctlr_task));
 
+#if !LS_SINGLE_BUFFER
+    // frame calculation is preempted by refresh timer and everything else
+    NVIC_SetPriority(SWI3_EGU3_IRQn, APP_IRQ_PRIORITY_LOWEST);
+    NVIC_ClearPendingIRQ(SWI3_EGU3_IRQn);
+    NVIC_EnableIRQ(SWI3_EGU3_IRQn);
+#endif
+
     led_ctlr = led_ctlr_create(led_ctlr_NeoPixel);
     led_ctlr->init(led_ctlr);
 
-    parseStream(stream, sizeof(stream), &curr_stream);
-    streamStart(&curr_stream);
+    for (uint8_t li = 0; li < LS_MAX_LAYER_COUNT; li++)
+        led_ctlr_layer(li, led_ctlr_blend_Replace, 255);
+
+    // particles are added on top of everything else
+    led_particle_clear();
+    led_ctlr_layer(LS_MAX_LAYER_COUNT - 1, led_ctlr_blend_Add, 255);
+    led_ctlr_particles(LS_MAX_LAYER_COUNT - 1);
+
+    // test stream drives all rows of the bottom layer
+    led_ctlr_play(0, stream, sizeof(stream));
+    for (uint8_t row = 0; row < led_ctlr->rows && row < LS_MAX_ROW_COUNT; row++)
+        led_ctlr_bind(0, row, 0, row);
+
+    return NRF_SUCCESS;
+}
+
+// validate all frames in stream order, frames skipped by jumps included
+//  cursor index is filled on the way, frame buffer geometry is reduced to the largest frame
+static int streamVerify(stream_info_t* s)
+{
+    int status;
+    stream_cursor_t c = s->index[0];
+    stream_frame_t f;
+    uint8_t rowCount = 0;
+    uint16_t ledCount = 0;
+
+    while (c.frame < s->frameCount)
+    {
+        status = frameParse(s, &c, &f, 0);
+        if (status != NRF_SUCCESS)
+            return status;
+
+        if (c.rowCount > rowCount)
+            rowCount = c.rowCount;
+
+        for (uint8_t row = 0; row < c.rowCount; row++)
+        {
+            if (c.ledCount[row] > ledCount)
+                ledCount = c.ledCount[row];
+        }
+    }
+
+    if (c.depth > 0)
+    {
+        NRF_LOG_ERROR("%d loops have no end", c.depth);
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    if (s->length - c.offset > 3)
+    {
+        NRF_LOG_ERROR("Extra data (%d bytes) at the end of the stream", s->length - c.offset);
+        return NRF_ERROR_INVALID_DATA;
+    }
+
+    NRF_LOG_DEBUG("Frame geometry: %d x %d", rowCount, ledCount);
+
+    s->maxRowCount = rowCount;
+    s->maxLedCount = ledCount;
+
+    return NRF_SUCCESS;
+}
+
+// load stream on a stream slot and calculate its first frame
+//  frames are verified unless 'rowCount' and 'ledCount' give geometry found by led_ctlr_check() before
+static int streamLoad(uint8_t stream, const uint8_t* data, size_t length, bool checked, uint8_t rowCount, uint16_t ledCount)
+{
+    int status;
+
+    if (stream >= LS_MAX_STREAM_COUNT)
+        return NRF_ERROR_INVALID_PARAM;
+
+    stream_info_t* s = &streams[stream];
+
+    // stream is not played while it is parsed
+    streamStop(s);
+
+    // invalid stream is rejected here, playback decodes frames again when it reaches them
+    status = parseStream(data, length, s);
+
+    if (status == NRF_SUCCESS && !checked)
+        status = streamVerify(s);
+    else if (status == NRF_SUCCESS)
+    {
+        if (rowCount > s->maxRowCount || ledCount > s->maxLedCount)
+        {
+            NRF_LOG_ERROR("Geometry %d x %d exceeds stream limit %d x %d", rowCount, ledCount, s->maxRowCount, s->maxLedCount);
+            status = NRF_ERROR_INVALID_DATA;
+        }
+
+        s->maxRowCount = rowCount;
+        s->maxLedCount = ledCount;
+    }
+
+    // buffers of other streams may move, refresh timer must not run meanwhile
+    //  frames are only calculated when the timer requests them
+    if (led_ctlr_running)
+        app_timer_stop(led_task_timer);
+
+    // frame buffers are sized by stream geometry
+    if (status == NRF_SUCCESS)
+        status = arenaAlloc(stream, LS_STREAM_BUFFER_COUNT * (uint32_t)s->maxRowCount * s->maxLedCount);
+
+    if (status != NRF_SUCCESS)
+    {
+        s->stream = NULL;
+        arenaAlloc(stream, 0);
+    }
+    else
+    {
+        streamBuffers(s);
+        s->currRefresh = 0;
+        streamStart(s);
+    }
+
+    if (led_ctlr_running)
+        app_timer_start(led_task_timer, APP_TIMER_TICKS(10), NULL);
+
+    return status;
+}
+
+int led_ctlr_play(uint8_t stream, const uint8_t* data, size_t length)
+{
+    return streamLoad(stream, data, length, false, 0, 0);
+}
+
+int led_ctlr_play_checked(uint8_t stream, const uint8_t* data, size_t length, uint8_t rowCount, uint16_t ledCount)
+{
+    return streamLoad(stream, data, length, true, rowCount, ledCount);
+}
+
+int led_ctlr_check(const uint8_t* data, size_t length, uint8_t* rowCount, uint16_t* ledCount)
+{
+    // stream slots are not touched, upload is checked while shows are played
+    static stream_info_t s;
+
+    int status = parseStream(data, length, &s);
+
+    if (status == NRF_SUCCESS)
+        status = streamVerify(&s);
+
+    *rowCount = s.maxRowCount;
+    *ledCount = s.maxLedCount;
+
+    return status;
+}
+
+int led_ctlr_stop(uint8_t stream)
+{
+    if (stream >= LS_MAX_STREAM_COUNT)
+        return NRF_ERROR_INVALID_PARAM;
+
+    streamStop(&streams[stream]);
+
+    // frame buffers are given back to the arena
+    if (led_ctlr_running)
+        app_timer_stop(led_task_timer);
+
+    arenaAlloc(stream, 0);
+
+    if (led_ctlr_running)
+        app_timer_start(led_task_timer, APP_TIMER_TICKS(10), NULL);
+
+    return NRF_SUCCESS;
+}
+
+bool led_ctlr_plays(const uint8_t* data, size_t length)
+{
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+    {
+        const stream_info_t* s = &streams[i];
+
+        if (s->stream != NULL && s->stream < data + length && s->stream + s->length > data)
+            return true;
+    }
+
+    return false;
+}
+
+int led_ctlr_layer(uint8_t layer, led_ctlr_blend_t blend, uint8_t opacity)
+{
+    if (layer >= LS_MAX_LAYER_COUNT || blend >= led_ctlr_blend_Max)
+        return NRF_ERROR_INVALID_PARAM;
+
+    layers[layer].blend = blend;
+    layers[layer].opacity = opacity + (opacity >> 7);   // 255 is 256
+
+    for (uint8_t row = 0; row < LS_MAX_ROW_COUNT; row++)
+        rowDirty[row] = true;
+
+    return NRF_SUCCESS;
+}
+
+int led_ctlr_bind(uint8_t layer, uint8_t row, uint8_t stream, uint8_t streamRow)
+{
+    if (layer >= LS_MAX_LAYER_COUNT || row >= LS_MAX_ROW_COUNT || row >= led_ctlr->rows || streamRow >= LS_MAX_ROW_COUNT)
+        return NRF_ERROR_INVALID_PARAM;
+
+    layer_row_t* lr = &layers[layer].row[row];
+
+    lr->stream = (stream < LS_MAX_STREAM_COUNT) ? &streams[stream] : NULL;
+    lr->row = streamRow;
+    lr->hostCount = 0;
+    rowDirty[row] = true;
 
     return NRF_SUCCESS;
 }
 
+int led_ctlr_pixels(uint8_t layer, uint8_t row, const uint32_t* pixels, uint16_t count)
+{
+    if (layer >= LS_MAX_LAYER_COUNT || row >= LS_MAX_ROW_COUNT || row >= led_ctlr->rows || count > LS_MAX_LED_COUNT)
+        return NRF_ERROR_INVALID_PARAM;
+
+    layer_t* l = &layers[layer];
+    layer_row_t* lr = &l->row[row];
+
+    memcpy(l->host + row * LS_MAX_LED_COUNT, pixels, count * sizeof(uint32_t));
+    lr->stream = NULL;
+    lr->hostCount = count;
+    lr->hostSeq++;
+    rowDirty[row] = true;
+
+    return NRF_SUCCESS;
+}
+
+int led_ctlr_particles(uint8_t layer)
+{
+    if (layer > LS_MAX_LAYER_COUNT)
+        return NRF_ERROR_INVALID_PARAM;
+
+    // previous particle layer is left without pixels
+    if (particleLayer < LS_MAX_LAYER_COUNT)
+    {
+        for (uint8_t row = 0; row < LS_MAX_ROW_COUNT; row++)
+            layers[particleLayer].row[row].hostCount = 0;
+    }
+
+    particleLayer = layer;
+
+    if (layer < LS_MAX_LAYER_COUNT)
+    {
+        for (uint8_t row = 0; row < LS_MAX_ROW_COUNT; row++)
+        {
+            layers[layer].row[row].stream = NULL;
+            layers[layer].row[row].hostCount = 0;
+        }
+    }
+
+    for (uint8_t row = 0; row < LS_MAX_ROW_COUNT; row++)
+        rowDirty[row] = true;
+
+    return NRF_SUCCESS;
+}
+
+int led_ctlr_spawn(const led_particle_spawn_t* spawn)
+{
+    int status;
+
+    // particles are moved by refresh timer which may interrupt the caller
+    CRITICAL_REGION_ENTER();
+    status = led_particle_spawn(spawn);
+    CRITICAL_REGION_EXIT();
+
+    return status;
+}
+
+void led_ctlr_particle_stats(uint16_t* used, uint16_t* peak, uint32_t* dropped)
+{
+    led_particle_stats(used, peak, dropped);
+}
+
 void led_ctlr_start()
 {
+    // first frame is sent right away, refresh timer waits for low frequency clock to start
+    led_ctlr_task(NULL);
+
     app_timer_start(led_task_timer, APP_TIMER_TICKS(10), NULL);
+    led_ctlr_running = true;
+}
+
+// stream time unit in milliseconds, refresh period 0 works as 1
+static uint32_t streamPeriod(const stream_info_t* s)
+{
+    return (s->refreshPeriod > 0 ? s->refreshPeriod : 1) * LS_REFRESH_UNIT;
+}
+
+uint32_t led_ctlr_time()
+{
+    return streams[0].state.time * streamPeriod(&streams[0]);
+}
+
+void led_ctlr_position(uint16_t* frame, uint16_t* repeat)
+{
+    *frame = streams[0].state.frame.number;
+    *repeat = streams[0].state.frameRepeat;
+}
+
+void led_ctlr_snapshot_stats(uint32_t* hits, uint32_t* misses)
+{
+    *hits = 0;
+    *misses = 0;
+
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+    {
+        *hits += streams[i].snapshotHits;
+        *misses += streams[i].snapshotMisses;
+    }
+}
+
+void led_ctlr_arena_stats(uint32_t* used, uint32_t* free)
+{
+    *used = 0;
+
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+        *used += arenaSize[i] * sizeof(led_ctlr_pixel_t);
+
+    *free = sizeof(arena) - *used;
+}
+
+void led_ctlr_seek(uint32_t time)
+{
+    // refresh timer must not run while the position is rebuilt
+    if (led_ctlr_running)
+        app_timer_stop(led_task_timer);
+
+    // particles spawned before the seek do not belong to the new position
+    led_particle_clear();
+
+    for (uint8_t i = 0; i < LS_MAX_STREAM_COUNT; i++)
+    {
+        stream_info_t* s = &streams[i];
+
+        if (s->stream == NULL)
+            continue;
+
+        s->currRefresh = 0;
+        s->due = 0;
+        s->done = 0;
+        streamSeekTime(s, time / streamPeriod(s));
+    }
+
+    if (led_ctlr_running)
+        app_timer_start(led_task_timer, APP_TIMER_TICKS(10), NULL);
 }
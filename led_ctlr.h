@@ -2,9 +2,78 @@
 #define LED_CTLR_H
 
 #include "led_ctlr_hw.h"
+#include "led_particle.h"
+
+// how layer pixels are combined with layers below
+typedef enum led_ctlr_blend
+{
+    led_ctlr_blend_Replace = 0,     // layer pixels replace pixels below
+    led_ctlr_blend_Add,             // layer pixels are added, saturated to 255
+    led_ctlr_blend_Multiply,        // pixels below are multiplied by layer pixels
+    led_ctlr_blend_Alpha,           // like Replace, weighted by pixel alpha (AA of AAGGRRBB)
+    led_ctlr_blend_Max
+} led_ctlr_blend_t;
 
 int led_ctlr_init(led_ctlr_mode_t mode);
 
+// send the first frame and start refresh timer
 void led_ctlr_start();
 
+// play show stream on one of LS_MAX_STREAM_COUNT stream slots
+//  all frames are validated before the stream starts, returns NRF_ERROR_INVALID_DATA if any of them is invalid
+//  stream data must stay valid while the stream is played, time index for seek is built by the first seek
+int led_ctlr_play(uint8_t stream, const uint8_t* data, size_t length);
+
+// play show stream validated by led_ctlr_check() before, only the stream header is parsed
+//  'rowCount' and 'ledCount' are the frame geometry led_ctlr_check() returned
+int led_ctlr_play_checked(uint8_t stream, const uint8_t* data, size_t length, uint8_t rowCount, uint16_t ledCount);
+
+// validate show stream like led_ctlr_play() without playing it, not reentrant
+//  returns NRF_SUCCESS or NRF_ERROR_INVALID_DATA, and the largest frame geometry
+int led_ctlr_check(const uint8_t* data, size_t length, uint8_t* rowCount, uint16_t* ledCount);
+
+// stop stream slot, rows bound to it are left dark
+int led_ctlr_stop(uint8_t stream);
+
+// any stream is played from data in given memory range
+bool led_ctlr_plays(const uint8_t* data, size_t length);
+
+// set blend mode and opacity (0..255) of one of LS_MAX_LAYER_COUNT layers
+//  layers are composed bottom up starting from layer 0
+int led_ctlr_layer(uint8_t layer, led_ctlr_blend_t blend, uint8_t opacity);
+
+// show row of a stream on a row of a layer, stream >= LS_MAX_STREAM_COUNT leaves the row unused
+int led_ctlr_bind(uint8_t layer, uint8_t row, uint8_t stream, uint8_t streamRow);
+
+// show host pixels (AAGGRRBB) on a row of a layer, count 0 leaves the row unused
+int led_ctlr_pixels(uint8_t layer, uint8_t row, const uint32_t* pixels, uint16_t count);
+
+// show particles on a layer instead of its streams and host pixels, LS_MAX_LAYER_COUNT hides particles
+//  by default particles are shown on the top layer which blends them with led_ctlr_blend_Add
+int led_ctlr_particles(uint8_t layer);
+
+// add particles, same as Spawn frame of a stream
+int led_ctlr_spawn(const led_particle_spawn_t* spawn);
+
+// particles in use, max in use and dropped since start or last seek
+void led_ctlr_particle_stats(uint16_t* used, uint16_t* peak, uint32_t* dropped);
+
+// bytes of frame buffer arena used by streams and left for more streams
+//  each stream takes 3 buffers (1 with LS_SINGLE_BUFFER) of the largest row and led count of its frames
+void led_ctlr_arena_stats(uint32_t* used, uint32_t* free);
+
+// current show time of stream 0 in milliseconds
+uint32_t led_ctlr_time();
+
+// current frame number and its repeat counter of stream 0
+void led_ctlr_position(uint16_t* frame, uint16_t* repeat);
+
+// continue all streams at given time in milliseconds
+//  frame headers are walked from the closest Base frame of the time index, time in repeating playback
+//  is mapped into its indexed period, the first seek of a stream builds the index, see LS_TIME_WALK_LIMIT
+void led_ctlr_seek(uint32_t time);
+
+// number of seeks that did and did not find a frame snapshot
+void led_ctlr_snapshot_stats(uint32_t* hits, uint32_t* misses);
+
 #endif /* LED_CTLR_H */
\ No newline at end of file
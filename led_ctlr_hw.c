@@ -11,6 +11,7 @@
 #include "app_timer.h"
 
 #include "led_ctlr_hw.h"
+#include "led_stack.h"
 
 
 // Brightness to PWM value lookup table
@@ -85,18 +86,46 @@ static int np_encRGB(uint8_t r, uint8_t g, uint8_t b, uint8_t* buf)
     return 15;
 }
 
+#if LS_PIXEL_PACKED
+// packed pixel bytes are encoded as they are
+static int np_encPixel(const led_ctlr_pixel_t* px, uint8_t* buf)
+{
+    return np_encRGB(px->r, px->g, px->b, buf);
+}
+#else
 static int np_enc24(uint32_t data, uint8_t* buf)
 {
     return np_encRGB((data & 0x00FF00) >> 8, (data & 0xFF0000) >> 16, (data & 0x0000FF) >> 0, buf);
 }
 
+static int np_encPixel(const led_ctlr_pixel_t* px, uint8_t* buf)
+{
+    return np_enc24(*px, buf);
+}
+#endif
+
+// encode ring buffer of LEDs starting at 'start', including protecting bytes
+static size_t np_encRow(const led_ctlr_pixel_t* buf, uint16_t len, uint16_t start, uint8_t* out)
+{
+    uint8_t* p = out;
+
+    LED_STACK_PROBE(led_stack_Refresh);
+    *p++ = 0;
+    for (int i = start; i < len; i++)
+        p += np_encPixel(&buf[i], p);
+    for (int i = 0; i < start; i++)
+        p += np_encPixel(&buf[i], p);
+    *p++ = 0;
+    return p - out;
+}
+
 #if defined(BOARD_PCA10056)
 // 52840 DK supports legacy NeoPixel and Dotstar driver boards
 //  connected to single SPI and GPIO pins
 
 static int np_init(led_ctlr_hw_t* hw);
 static int np_clear(led_ctlr_hw_t* hw);
-static int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len );
+static int np_show(led_ctlr_hw_t* hw, uint8_t row, const led_ctlr_pixel_t* buf, uint16_t len, uint16_t start);
 
 struct hw_NeoPixel
 {
@@ -143,6 +172,8 @@ static void np_event_handler(nrfx_spim_evt_t const * p_event, void * p_context)
 {
     struct hw_NeoPixel * np = (struct hw_NeoPixel*)p_context;
 
+    LED_STACK_PROBE(led_stack_Spim);
+
     for (int i=0; i<4; i++)
         nrf_gpio_pin_set(np->row[i]);
 
@@ -179,7 +210,7 @@ int np_clear(led_ctlr_hw_t* hw)
     return 0;
 }
 
-int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len)
+int np_show(led_ctlr_hw_t* hw, uint8_t row, const led_ctlr_pixel_t* buf, uint16_t len, uint16_t start)
 {
     struct hw_NeoPixel * np = CONTAINER_OF(hw, struct hw_NeoPixel, hw);
 
@@ -188,17 +219,7 @@ int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len)
         nrf_gpio_pin_set(np->row[i]);
     nrf_gpio_pin_clear(np->row[row]);
 
-    uint8_t* p = np->buf;
-    size_t l = 1;
-    *p++ = 0;
-    for (int i = 0; i < len; i++)
-    {
-        int ll = np_enc24(buf[i], p);
-        l += ll;
-        p += ll;
-    }
-    p[l++] = 0;
-    np->xfer_desc.tx_length = l;
+    np->xfer_desc.tx_length = np_encRow(buf, len, start, np->buf);
 
     np->active = true;
     APP_ERROR_CHECK(nrfx_spim_xfer(&np->spi, &np->xfer_desc, 0));
@@ -219,7 +240,7 @@ int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len)
 
 static int np_init(led_ctlr_hw_t* hw);
 static int np_clear(led_ctlr_hw_t* hw);
-static int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len );
+static int np_show(led_ctlr_hw_t* hw, uint8_t row, const led_ctlr_pixel_t* buf, uint16_t len, uint16_t start);
 
 typedef struct _hw_np_row   // 4 rows on 4 individial SPI channels
 {
@@ -304,6 +325,8 @@ static void np_event_handler(nrfx_spim_evt_t const * p_event, void * p_context)
     hw_np_row * r = (hw_np_row *)p_context;
 //    struct hw_NeoPixel * np = CONTAINER_OF(r, struct hw_NeoPixel, row[r->row]);
 
+    LED_STACK_PROBE(led_stack_Spim);
+
     r->active = false;
     nrf_gpio_pin_set(r->oe);
 }
@@ -341,21 +364,12 @@ int np_clear(led_ctlr_hw_t* hw)
     return 0;
 }
 
-int np_show(led_ctlr_hw_t* hw, uint8_t row, uint32_t* buf, uint8_t len)
+int np_show(led_ctlr_hw_t* hw, uint8_t row, const led_ctlr_pixel_t* buf, uint16_t len, uint16_t start)
 {
     struct hw_NeoPixel * np = CONTAINER_OF(hw, struct hw_NeoPixel, hw);
     hw_np_row * r = &np->row[row];
-    uint8_t* p = r->buf;
-    size_t l = 1;
-    *p++ = 0;
-    for (int i = 0; i < len; i++)
-    {
-        int ll = np_enc24(buf[i], p);
-        l += ll;
-        p += ll;
-    }
-    p[l++] = 0;
-    r->xfer_desc.tx_length = l;
+
+    r->xfer_desc.tx_length = np_encRow(buf, len, start, r->buf);
 
     nrf_gpio_pin_clear(r->oe);
     r->active = true;
@@ -9,6 +9,82 @@ typedef enum led_ctlr_mode
     led_ctlr_DotStar  = (1 << 1),
 } led_ctlr_mode_t; 
 
+// frame buffer pixel, set LS_PIXEL_PACKED to 1 to keep 3 bytes per pixel instead of 4
+#ifndef LS_PIXEL_PACKED
+#define LS_PIXEL_PACKED 0
+#endif
+
+// pixel value - 00GGRRBB
+#define PIXEL(R, G, B) (((uint32_t)(G) << 16) | ((uint32_t)(R) << 8) | ((uint32_t)(B) << 0))
+
+#if LS_PIXEL_PACKED
+typedef struct led_ctlr_pixel   // colors in NeoPixel wire order, encoder reads them without unpacking
+{
+    uint8_t g;
+    uint8_t r;
+    uint8_t b;
+} led_ctlr_pixel_t;
+
+static inline uint32_t led_ctlr_pixel_get(const led_ctlr_pixel_t* p)
+{
+    return ((uint32_t)p->g << 16) | ((uint32_t)p->r << 8) | p->b;
+}
+
+static inline void led_ctlr_pixel_set(led_ctlr_pixel_t* p, uint32_t v)
+{
+    p->g = v >> 16;
+    p->r = v >> 8;
+    p->b = v;
+}
+#else
+typedef uint32_t led_ctlr_pixel_t;  // 00GGRRBB
+
+static inline uint32_t led_ctlr_pixel_get(const led_ctlr_pixel_t* p)
+{
+    return *p;
+}
+
+static inline void led_ctlr_pixel_set(led_ctlr_pixel_t* p, uint32_t v)
+{
+    *p = v;
+}
+#endif
+
+// pixel math works on two 8-bit channels in 16-bit lanes of 0x00FF00FF
+//  pixel AAGGRRBB is split to GG,BB lanes and AA,RR lanes
+#define LED_PIXEL_LANES 0x00FF00FFu
+
+// d * (256 - a) + s * a for each lane, a is 0..256
+static inline uint32_t led_pixel_lanes_mix(uint32_t d, uint32_t s, uint16_t a)
+{
+    return ((d * (256 - a) + s * a) >> 8) & LED_PIXEL_LANES;
+}
+
+// d + s * a for each lane, a is 0..256, saturated to 255
+static inline uint32_t led_pixel_lanes_add(uint32_t d, uint32_t s, uint16_t a)
+{
+    uint32_t t = d + (((s * a) >> 8) & LED_PIXEL_LANES);
+
+    // carry out of a lane sets the lane to 255
+    t |= ((t >> 8) & 0x00010001u) * 0xFF;
+    return t & LED_PIXEL_LANES;
+}
+
+// pixel with each color multiplied by k / 256, k 0..256
+static inline uint32_t led_pixel_scale(uint32_t v, uint16_t k)
+{
+    return ((((v & LED_PIXEL_LANES) * k) >> 8) & LED_PIXEL_LANES) | ((((v & 0x0000FF00) * k) >> 8) & 0x0000FF00);
+}
+
+// d + s for each color, saturated to 255
+static inline uint32_t led_pixel_add(uint32_t d, uint32_t s)
+{
+    uint32_t l = led_pixel_lanes_add(d & LED_PIXEL_LANES, s & LED_PIXEL_LANES, 256);
+    uint32_t h = led_pixel_lanes_add((d >> 8) & LED_PIXEL_LANES, (s >> 8) & LED_PIXEL_LANES, 256);
+
+    return l | (h << 8);
+}
+
 // led_ctlr_hw - controller HW interface
 //  includes SPIs, row select GPIOs, external 3.3-5 drivers
 //  this does not include features of the LED set attached to the controller
@@ -26,8 +102,9 @@ struct led_ctlr_hw
     
     int (*show)(led_ctlr_hw_t* hw,      // show content of buffer
         uint8_t row,                    // row number
-        uint32_t* buf,                  // buffer containing row data, 00RRGGBB
-        uint8_t len                     // buffer length (in uint32_t)
+        const led_ctlr_pixel_t* buf,    // buffer containing row data
+        uint16_t len,                   // buffer length (in pixels)
+        uint16_t start                  // index of the first LED, buffer is a ring of 'len' LEDs
     );
 };
 
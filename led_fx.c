@@ -0,0 +1,289 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nrf_error.h"
+
+#define NRF_LOG_LEVEL NRF_LOG_SEVERITY_INFO
+#include "nrf_log.h"
+
+#include "led_fx.h"
+#include "led_vm.h"
+#include "led_stack.h"
+#include "led_ctlr_hw.h"
+
+#if LS_FX_PROFILE
+#include "nrf.h"
+#endif
+
+// parameter length of each effect
+static const uint8_t paramLength[ls_fx_Count] =
+{
+    [ls_fx_Rainbow] = 3,
+    [ls_fx_Chase]   = 5,
+    [ls_fx_Twinkle] = 5,
+    [ls_fx_Fire]    = 3,
+    [ls_fx_Breathe] = 4,
+    [ls_fx_Comet]   = 5,
+    [ls_fx_Noise]   = 3,
+};
+
+#if LS_FX_PROFILE
+static uint32_t profCycles[ls_fx_Count];    // cycles spent in effect since last report
+static uint32_t profLeds[ls_fx_Count];      // leds calculated since last report
+static uint32_t profRows;                   // rows calculated since last report
+#endif
+
+int led_fx_verify(uint8_t effect, const uint8_t* param, uint8_t length)
+{
+    int status = NRF_ERROR_INVALID_DATA;
+
+    if (effect >= ls_fx_Count)
+    {
+        NRF_LOG_ERROR("Invalid effect %d", effect);
+        goto RetErr;
+    }
+
+    if (length != paramLength[effect])
+    {
+        NRF_LOG_ERROR("Parameter length %d of effect %d is invalid, expected %d", length, effect, paramLength[effect]);
+        goto RetErr;
+    }
+
+    switch (effect)
+    {
+    case ls_fx_Chase:
+        if (param[3] == 0 || param[4] == 0)
+        {
+            NRF_LOG_ERROR("Chase spacing %d or hold %d is invalid", param[3], param[4]);
+            goto RetErr;
+        }
+        break;
+
+    case ls_fx_Comet:
+        if (param[3] == 0)
+        {
+            NRF_LOG_ERROR("Comet tail length is invalid");
+            goto RetErr;
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    status = NRF_SUCCESS;
+
+RetErr:
+    return status;
+}
+
+// brightness 0..255 to led_pixel_scale() factor 0..256
+static uint16_t brightScale(uint8_t b)
+{
+    return b + (b >> 7);
+}
+
+// fully saturated color of hue 0..255
+static uint32_t hueColor(uint8_t hue)
+{
+    uint16_t x = (uint16_t)hue * 6;
+    uint8_t up = x & 0xFF;
+    uint8_t down = 255 - up;
+
+    switch (x >> 8)
+    {
+    case 0:  return PIXEL(255, up, 0);
+    case 1:  return PIXEL(down, 255, 0);
+    case 2:  return PIXEL(0, 255, up);
+    case 3:  return PIXEL(0, down, 255);
+    case 4:  return PIXEL(up, 0, 255);
+    default: return PIXEL(255, 0, down);
+    }
+}
+
+// black - red - yellow - white
+static uint32_t heatColor(uint8_t heat)
+{
+    uint16_t h = (uint16_t)heat * 3;
+
+    if (h < 256)
+        return PIXEL(h, 0, 0);
+    if (h < 512)
+        return PIXEL(255, h - 256, 0);
+    return PIXEL(255, 255, h - 512);
+}
+
+static uint8_t hash8(uint32_t x)
+{
+    x *= 0x9E3779B1;
+    x ^= x >> 15;
+    x *= 0x85EBCA77;
+    return x >> 24;
+}
+
+// value noise smoothly interpolated between random values at integer points, x is 24.8 fixed point
+static uint8_t noise8(uint32_t x)
+{
+    uint32_t f = x & 0xFF;
+    int32_t a = hash8(x >> 8);
+    int32_t b = hash8((x >> 8) + 1);
+    int32_t s = (f * f * (768 - 2 * f)) >> 16;     // smoothstep 0..255
+
+    return a + (((b - a) * s) >> 8);
+}
+
+void led_fx_row(uint8_t effect, const uint8_t* param, uint32_t time, uint8_t row, uint32_t* r, uint16_t ledCount)
+{
+    LED_STACK_PROBE(led_stack_Compute);
+
+#if LS_FX_PROFILE
+    led_stack_cycles_start();
+    uint32_t cycles = DWT->CYCCNT;
+#endif
+
+    // effect was validated by led_fx_verify()
+    //  values that need division are calculated before the led loop
+    switch (effect)
+    {
+    case ls_fx_Rainbow:
+    {
+        uint8_t hue = time * param[0];
+        uint16_t k = brightScale(param[2]);
+
+        for (uint16_t led = 0; led < ledCount; led++, hue += param[1])
+            r[led] = led_pixel_scale(hueColor(hue), k);
+
+        break;
+    }
+
+    case ls_fx_Chase:
+    {
+        uint32_t color = PIXEL(param[0], param[1], param[2]);
+        uint8_t spacing = param[3];
+        uint8_t phase = (time / param[4]) % spacing;
+        uint8_t c = (spacing - phase) % spacing;    // (led - phase) modulo spacing
+
+        for (uint16_t led = 0; led < ledCount; led++)
+        {
+            r[led] = (c == 0) ? color : 0;
+            if (++c >= spacing)
+                c = 0;
+        }
+
+        break;
+    }
+
+    case ls_fx_Twinkle:
+    {
+        uint32_t color = PIXEL(param[0], param[1], param[2]);
+        uint32_t t = time * param[4];
+        uint32_t id = (uint32_t)row << 16;
+
+        // each led has its own phase, one twinkle takes 512 / speed refresh periods
+        //  the led is lit in some of the twinkles only
+        for (uint16_t led = 0; led < ledCount; led++, id++)
+        {
+            uint32_t phase = t + ((uint32_t)hash8(id) << 1);
+            uint8_t f = phase >> 1;
+            uint8_t b = (f < 128) ? f * 2 : (255 - f) * 2;
+
+            if (hash8(id ^ ((phase >> 9) * 0x2545F491)) < param[3])
+                r[led] = led_pixel_scale(color, b);
+            else
+                r[led] = 0;
+        }
+
+        break;
+    }
+
+    case ls_fx_Fire:
+    {
+        uint32_t cool = ((uint32_t)param[0] << 8) / ledCount;  // heat lost per led, 8.8 fixed point
+        uint32_t loss = 0;
+        uint32_t step = (uint32_t)param[2] << 2;
+        uint32_t x = ((uint32_t)row << 20) - time * param[1] * 16;
+
+        // noise moves towards the row end, two octaves
+        for (uint16_t led = 0; led < ledCount; led++, x += step, loss += cool)
+        {
+            uint8_t n1 = noise8(x);
+            uint8_t n2 = noise8(2 * x + 0x55555);
+            int32_t heat = n1 - (n1 >> 2) + (n2 >> 2) - (int32_t)(loss >> 8);
+
+            r[led] = heatColor(heat < 0 ? 0 : heat);
+        }
+
+        break;
+    }
+
+    case ls_fx_Breathe:
+    {
+        uint32_t color = PIXEL(param[0], param[1], param[2]);
+        uint32_t c = led_pixel_scale(color, led_vm_sin8[((time * param[3]) >> 2) & 0xFF]);
+
+        for (uint16_t led = 0; led < ledCount; led++)
+            r[led] = c;
+
+        break;
+    }
+
+    case ls_fx_Comet:
+    {
+        uint32_t color = PIXEL(param[0], param[1], param[2]);
+        uint16_t length = param[3];
+        uint16_t fade = 256 / length;
+        int32_t d = ((time * param[4]) >> 4) % (ledCount + length);   // distance from the head
+
+        for (uint16_t led = 0; led < ledCount; led++, d--)
+        {
+            if (d >= 0 && d < length)
+                r[led] = led_pixel_scale(color, 256 - d * fade);
+            else
+                r[led] = 0;
+        }
+
+        break;
+    }
+
+    case ls_fx_Noise:
+    {
+        uint32_t t = time * param[0] * 4;
+        uint32_t step = (uint32_t)param[1] << 2;
+        uint32_t x = (uint32_t)row << 20;
+        uint16_t k = brightScale(param[2]);
+
+        // two noise layers flow in opposite directions, hue wraps around
+        for (uint16_t led = 0; led < ledCount; led++, x += step)
+        {
+            uint8_t hue = noise8(x + t) + noise8(2 * x - t + 0x80000);
+
+            r[led] = led_pixel_scale(hueColor(hue), k);
+        }
+
+        break;
+    }
+
+    default:
+        break;
+    }
+
+#if LS_FX_PROFILE
+    profCycles[effect] += DWT->CYCCNT - cycles;
+    profLeds[effect] += ledCount;
+
+    if (++profRows >= LS_FX_PROFILE_ROWS)
+    {
+        for (uint8_t i = 0; i < ls_fx_Count; i++)
+        {
+            if (profLeds[i] == 0)
+                continue;
+
+            NRF_LOG_INFO("Effect %d: %d cycles/led  %d ns/led", i, profCycles[i] / profLeds[i],
+                (uint32_t)((uint64_t)profCycles[i] * 1000 / (SystemCoreClock / 1000000) / profLeds[i]));
+            profCycles[i] = 0;
+            profLeds[i] = 0;
+        }
+        profRows = 0;
+    }
+#endif
+}
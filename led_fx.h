@@ -0,0 +1,19 @@
+#ifndef LED_FX_H
+#define LED_FX_H
+
+#include "led_show.h"
+
+// set to 1 to measure effect cost with DWT cycle counter, average is logged every LS_FX_PROFILE_ROWS rows
+#ifndef LS_FX_PROFILE
+#define LS_FX_PROFILE 0
+#endif
+#define LS_FX_PROFILE_ROWS 1024
+
+// validate effect id and parameters
+//  returns NRF_SUCCESS or NRF_ERROR_INVALID_DATA
+int led_fx_verify(uint8_t effect, const uint8_t* param, uint8_t length);
+
+// calculate row of validated effect at stream time, store led values (00GGRRBB) to r
+void led_fx_row(uint8_t effect, const uint8_t* param, uint32_t time, uint8_t row, uint32_t* r, uint16_t ledCount);
+
+#endif /*LED_FX_H*/
@@ -0,0 +1,146 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nrf_error.h"
+
+#include "led_particle.h"
+#include "led_ctlr_hw.h"
+
+typedef struct particle
+{
+    int32_t pos;            // 16.16 fixed point led
+    int32_t vel;
+    int32_t accel;
+    uint32_t color;         // 00GGRRBB
+    uint16_t life;          // remaining refresh units, 0 if the slot is free
+    uint16_t bright;        // 8.8 fixed point
+    uint16_t decay;
+    uint8_t row;
+} particle_t;
+
+// fixed pool, free slots are kept on a stack so spawn does not search the pool
+static particle_t pool[LS_MAX_PARTICLE_COUNT];
+static uint16_t freeSlot[LS_MAX_PARTICLE_COUNT];
+static uint16_t freeCount;
+static uint16_t peakCount;      // max particles in use since clear
+static uint32_t dropCount;      // particles that did not fit since clear
+static uint32_t randomState = 1; // xorshift32 state
+
+static uint32_t random32()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+
+    return randomState;
+}
+
+void led_particle_clear()
+{
+    for (uint16_t i = 0; i < LS_MAX_PARTICLE_COUNT; i++)
+    {
+        pool[i].life = 0;
+        freeSlot[i] = LS_MAX_PARTICLE_COUNT - 1 - i;
+    }
+
+    freeCount = LS_MAX_PARTICLE_COUNT;
+    peakCount = 0;
+    dropCount = 0;
+}
+
+int led_particle_spawn(const led_particle_spawn_t* spawn)
+{
+    uint16_t n = spawn->count;
+
+    if (spawn->row >= LS_MAX_ROW_COUNT || spawn->life == 0)
+        return NRF_ERROR_INVALID_PARAM;
+
+    // time spent does not depend on count once the pool is full
+    if (n > freeCount)
+    {
+        dropCount += n - freeCount;
+        n = freeCount;
+    }
+
+    for (uint16_t i = 0; i < n; i++)
+    {
+        particle_t* p = &pool[freeSlot[--freeCount]];
+
+        p->pos = spawn->pos;
+        p->vel = spawn->vel;
+        if (spawn->spread > 0)
+            p->vel += (int32_t)(random32() % (2 * (uint32_t)spawn->spread + 1)) - spawn->spread;
+        p->accel = spawn->accel;
+        p->color = spawn->color;
+        p->life = spawn->life;
+        p->bright = 255 << 8;
+        p->decay = spawn->decay;
+        p->row = spawn->row;
+    }
+
+    if (LS_MAX_PARTICLE_COUNT - freeCount > peakCount)
+        peakCount = LS_MAX_PARTICLE_COUNT - freeCount;
+
+    return n < spawn->count ? NRF_ERROR_NO_MEM : NRF_SUCCESS;
+}
+
+void led_particle_update()
+{
+    for (uint16_t i = 0; i < LS_MAX_PARTICLE_COUNT; i++)
+    {
+        particle_t* p = &pool[i];
+
+        if (p->life == 0)
+            continue;
+
+        p->vel += p->accel;
+        p->pos += p->vel;
+        p->bright = (p->bright > p->decay) ? p->bright - p->decay : 0;
+
+        // particles leaving the longest possible row are freed early
+        if (--p->life == 0 || p->bright == 0 || p->pos < 0 || p->pos >= ((int32_t)LS_MAX_LED_COUNT << 16))
+        {
+            p->life = 0;
+            freeSlot[freeCount++] = i;
+        }
+    }
+}
+
+uint16_t led_particle_render(uint8_t row, uint32_t* r, uint16_t ledCount)
+{
+    uint16_t n = 0;
+
+    for (uint16_t i = 0; i < LS_MAX_PARTICLE_COUNT; i++)
+    {
+        const particle_t* p = &pool[i];
+
+        if (p->life == 0 || p->row != row)
+            continue;
+
+        // particle between two leds lights both of them
+        uint16_t led = p->pos >> 16;
+        uint16_t f = (p->pos >> 8) & 0xFF;
+        uint32_t c = led_pixel_scale(p->color, (p->bright >> 8) + (p->bright >> 15));
+
+        if (led < ledCount)
+            r[led] = led_pixel_add(r[led], led_pixel_scale(c, 256 - f));
+        if (f > 0 && led + 1 < ledCount)
+            r[led + 1] = led_pixel_add(r[led + 1], led_pixel_scale(c, f));
+
+        n++;
+    }
+
+    return n;
+}
+
+uint16_t led_particle_count()
+{
+    return LS_MAX_PARTICLE_COUNT - freeCount;
+}
+
+void led_particle_stats(uint16_t* used, uint16_t* peak, uint32_t* dropped)
+{
+    *used = led_particle_count();
+    *peak = peakCount;
+    *dropped = dropCount;
+}
@@ -0,0 +1,40 @@
+#ifndef LED_PARTICLE_H
+#define LED_PARTICLE_H
+
+#include "led_show.h"
+
+// particles are moved once per LS_REFRESH_UNIT
+//  positions are in leds, 16.16 fixed point, velocity and acceleration in leds per refresh unit
+typedef struct led_particle_spawn
+{
+    uint8_t row;            // row the particles move along (less than LS_MAX_ROW_COUNT)
+    uint16_t count;         // number of particles
+    int32_t pos;            // start position
+    int32_t vel;            // start velocity
+    int32_t spread;         // each particle velocity differs by random value -spread..spread
+    int32_t accel;          // added to velocity every refresh unit
+    uint16_t life;          // particle lifetime in refresh units
+    uint32_t color;         // 00GGRRBB
+    uint16_t decay;         // brightness lost every refresh unit, full brightness is 255, 8.8 fixed point
+} led_particle_spawn_t;
+
+// free all particles
+void led_particle_clear();
+
+// add particles to the pool, particles that do not fit are dropped
+//  returns NRF_SUCCESS, NRF_ERROR_NO_MEM if some particles were dropped or NRF_ERROR_INVALID_PARAM
+int led_particle_spawn(const led_particle_spawn_t* spawn);
+
+// move all particles by one refresh unit, free expired ones
+void led_particle_update();
+
+// add particles of a row to row pixels (00GGRRBB), returns number of particles on the row
+uint16_t led_particle_render(uint8_t row, uint32_t* r, uint16_t ledCount);
+
+// number of particles in the pool
+uint16_t led_particle_count();
+
+// pool occupancy: particles in use, max in use since clear, particles dropped since clear
+void led_particle_stats(uint16_t* used, uint16_t* peak, uint32_t* dropped);
+
+#endif /*LED_PARTICLE_H*/
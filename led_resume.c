@@ -0,0 +1,239 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "nrf_error.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_atomic.h"
+#include "app_timer.h"
+#include "crc32.h"
+
+#define NRF_LOG_LEVEL NRF_LOG_SEVERITY_INFO
+#include "nrf_log.h"
+
+#include "led_ctlr.h"
+#include "led_resume.h"
+
+#define RESUME_PAGE 4096            // flash page size
+#define RESUME_MAGIC 0x524D534C     // 'LSMR' - retained checkpoint is valid
+#define RESUME_ERASED 0xFFFFFFFF    // value of erased flash word
+
+// checkpoint record, same in retained RAM and flash log
+typedef struct resume_record
+{
+    uint32_t seq;               // checkpoint number since the log was empty, latest record has the highest
+    uint32_t time;
+    uint16_t id;
+    uint16_t frame;
+    uint16_t repeat;
+    uint16_t check;             // low half of CRC-32 of the fields above
+} resume_record_t;
+
+#define RESUME_PAGE_RECORDS (RESUME_PAGE / sizeof(resume_record_t))
+#define RESUME_LOG_RECORDS (2 * RESUME_PAGE_RECORDS)
+
+// RESUME region of the linker script, two pages written in turns
+extern uint8_t __start_led_resume[];
+extern uint8_t __stop_led_resume[];
+
+#define resumeLog ((const resume_record_t*)__start_led_resume)
+
+// not cleared by startup code, content is random after power loss
+static struct
+{
+    uint32_t magic;
+    resume_record_t record;
+} retained __attribute__((section(".retained_ram")));
+
+static void resumeEvent(nrf_fstorage_evt_t* evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t resumeFlash) =
+{
+    .evt_handler = resumeEvent,
+};
+
+APP_TIMER_DEF(resumeTimer);
+
+static resume_record_t found;       // checkpoint found at boot
+static bool haveFound;
+static uint32_t seq;                // number of the next checkpoint
+static uint16_t showId;            // show of the latest checkpoint, then of the show being played
+static uint16_t checkpoints;        // checkpoints since the last flash record
+static uint32_t logNext;            // log slot of the next flash record
+static bool eraseNext;              // page of the next flash record must be erased first
+static resume_record_t logRecord;   // flash record being written
+static nrf_atomic_u32_t pending;    // flash operations in progress
+
+static uint16_t recordCheck(const resume_record_t* r)
+{
+    return crc32_compute((const uint8_t*)r, offsetof(resume_record_t, check), NULL);
+}
+
+static bool recordErased(const resume_record_t* r)
+{
+    const uint32_t* w = (const uint32_t*)r;
+
+    for (uint8_t i = 0; i < sizeof(resume_record_t) / sizeof(uint32_t); i++)
+        if (w[i] != RESUME_ERASED)
+            return false;
+
+    return true;
+}
+
+static void resumeEvent(nrf_fstorage_evt_t* evt)
+{
+    if (evt->result != NRF_SUCCESS)
+        NRF_LOG_ERROR("Checkpoint flash operation %d at %x failed: %d", evt->id, evt->addr, evt->result);
+
+    nrf_atomic_u32_sub(&pending, 1);
+}
+
+// append record to the flash log, the other page is erased when a page gets full
+//  the full page keeps the latest record until the first record is written to the erased one
+static void logWrite(const resume_record_t* r)
+{
+    uint32_t addr = (uint32_t)&resumeLog[logNext];
+
+    // flash operations read the record after the call returns
+    logRecord = *r;
+
+    if (eraseNext)
+    {
+        nrf_atomic_u32_add(&pending, 1);
+        if (nrf_fstorage_erase(&resumeFlash, addr, 1, NULL) != NRF_SUCCESS)
+        {
+            nrf_atomic_u32_sub(&pending, 1);
+            return;
+        }
+        eraseNext = false;
+    }
+
+    nrf_atomic_u32_add(&pending, 1);
+    if (nrf_fstorage_write(&resumeFlash, addr, &logRecord, sizeof(logRecord), NULL) != NRF_SUCCESS)
+    {
+        nrf_atomic_u32_sub(&pending, 1);
+        return;
+    }
+
+    if (++logNext >= RESUME_LOG_RECORDS)
+        logNext = 0;
+    eraseNext = (logNext % RESUME_PAGE_RECORDS) == 0;
+}
+
+static void resumeCheckpoint(void* p_context)
+{
+    resume_record_t r;
+
+    r.seq = seq++;
+    r.time = led_ctlr_time();
+    r.id = showId;
+    led_ctlr_position(&r.frame, &r.repeat);
+    r.check = recordCheck(&r);
+
+    // checkpoint is not valid while it is updated
+    retained.magic = 0;
+    retained.record = r;
+    retained.magic = RESUME_MAGIC;
+
+    // previous flash record is still being written, the next checkpoint tries again
+    if (++checkpoints >= LS_RESUME_FLASH_PERIOD && pending == 0)
+    {
+        checkpoints = 0;
+        logWrite(&r);
+    }
+}
+
+int led_resume_init()
+{
+    int status;
+    uint32_t latest = RESUME_LOG_RECORDS;
+
+    resumeFlash.start_addr = (uint32_t)__start_led_resume;
+    resumeFlash.end_addr = (uint32_t)__stop_led_resume;
+
+    status = nrf_fstorage_init(&resumeFlash, &nrf_fstorage_sd, NULL);
+    if (status != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Checkpoint flash init failed: %d", status);
+        goto RetErr;
+    }
+
+    status = app_timer_create(&resumeTimer, APP_TIMER_MODE_REPEATED, resumeCheckpoint);
+    if (status != NRF_SUCCESS)
+        goto RetErr;
+
+    // records interrupted by reset fail the check and are skipped
+    for (uint32_t i = 0; i < RESUME_LOG_RECORDS; i++)
+    {
+        const resume_record_t* r = &resumeLog[i];
+
+        if (r->check != recordCheck(r) || r->seq == RESUME_ERASED)
+            continue;
+
+        if (latest == RESUME_LOG_RECORDS || r->seq > resumeLog[latest].seq)
+            latest = i;
+    }
+
+    if (latest < RESUME_LOG_RECORDS)
+    {
+        found = resumeLog[latest];
+        haveFound = true;
+
+        // next record goes to the first erased slot after the latest one on the same page
+        logNext = latest + 1;
+        while (logNext % RESUME_PAGE_RECORDS != 0 && !recordErased(&resumeLog[logNext]))
+            logNext++;
+        if (logNext >= RESUME_LOG_RECORDS)
+            logNext = 0;
+    }
+    else
+        logNext = 0;
+
+    eraseNext = (logNext % RESUME_PAGE_RECORDS) == 0;
+
+    // retained checkpoint is newer unless power was lost
+    if (retained.magic == RESUME_MAGIC && retained.record.check == recordCheck(&retained.record) &&
+        (!haveFound || retained.record.seq >= found.seq))
+    {
+        found = retained.record;
+        haveFound = true;
+    }
+
+    seq = haveFound ? found.seq + 1 : 0;
+    showId = haveFound ? found.id : LS_RESUME_NO_SHOW;
+
+RetErr:
+    return status;
+}
+
+int led_resume_get(led_resume_point_t* point)
+{
+    if (!haveFound)
+        return NRF_ERROR_NOT_FOUND;
+
+    point->id = found.id;
+    point->frame = found.frame;
+    point->repeat = found.repeat;
+    point->time = found.time;
+
+    return NRF_SUCCESS;
+}
+
+void led_resume_start(uint16_t id)
+{
+    app_timer_stop(resumeTimer);
+
+    // previous checkpoint stays valid until the first new one unless it belongs to another show
+    //  then the first new checkpoint is also written to flash, the log does not resume the old show
+    checkpoints = 0;
+    if (id != showId)
+    {
+        retained.magic = 0;
+        checkpoints = LS_RESUME_FLASH_PERIOD - 1;
+    }
+
+    showId = id;
+
+    app_timer_start(resumeTimer, APP_TIMER_TICKS(LS_RESUME_PERIOD), NULL);
+}
@@ -0,0 +1,35 @@
+#ifndef LED_RESUME_H
+#define LED_RESUME_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// playback position checkpoints, restored at boot
+//  checkpoints are kept in RAM that is not cleared by reset (.retained_ram section) and survive
+//  soft, pin and watchdog resets, every LS_RESUME_FLASH_PERIOD-th checkpoint is also appended
+//  to a two page flash log (RESUME region of the linker script) that survives power loss
+//  16 byte records, one page erase per 256 flash checkpoints - about 4 hours with default periods
+#define LS_RESUME_PERIOD 1000       // checkpoint period in milliseconds
+#define LS_RESUME_FLASH_PERIOD 60   // checkpoints per flash record
+#define LS_RESUME_NO_SHOW 0xFFFF    // show id of the built-in test stream
+
+typedef struct led_resume_point
+{
+    uint16_t id;                // show id (see led_store.h)
+    uint16_t frame;             // frame number
+    uint16_t repeat;            // frame repeat counter
+    uint32_t time;              // show time in milliseconds
+} led_resume_point_t;
+
+// find the latest checkpoint saved before reset
+int led_resume_init();
+
+// checkpoint found by led_resume_init()
+//  returns NRF_SUCCESS or NRF_ERROR_NOT_FOUND
+int led_resume_get(led_resume_point_t* point);
+
+// start checkpoints of a show played on stream 0
+//  checkpoint of the same show is kept until the first new one, checkpoint of another show is dropped
+void led_resume_start(uint16_t id);
+
+#endif /*LED_RESUME_H*/
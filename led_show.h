@@ -2,9 +2,22 @@
 #define LED_SHOW_H
 
 #define LS_REFRESH_UNIT 10      // milliseconds
-#define LS_MAX_FRAME_COUNT 64   // max frames in show stream
+#define LS_MAX_FRAME_COUNT 0xFFFF // max frames in show stream
 #define LS_MAX_ROW_COUNT 4      // max number of LED rows
-#define LS_MAX_LED_COUNT 64     // max number of LEDs in a row
+#define LS_MAX_LED_COUNT 64     // max number of LEDs in a row, sizes output row buffers of each row
+#define LS_MAX_PALETTE_SIZE 256 // max number of colors in stream palette
+#define LS_MAX_LOOP_DEPTH 4     // max nesting depth of loops in show stream
+#define LS_MAX_STREAM_COUNT LS_MAX_ROW_COUNT // max streams played at the same time
+#define LS_ARENA_MEMORY 6144    // RAM for frame buffers of all streams (bytes), stream that does not fit is not played
+#define LS_MAX_LAYER_COUNT 3    // number of layers composed into output rows
+#define LS_MAX_PARTICLE_COUNT 64    // size of particle pool
+#define LS_VM_REG_COUNT 8       // number of program registers
+#define LS_VM_MAX_PROGRAM 512   // max program length in bytes
+#define LS_VM_STEP_BUDGET 4096  // max instructions executed by a program frame
+
+#define LS_STREAM_PALETTE 0x80  // frame count flag (v1), stream flag (v2) - palette block follows stream header
+
+#define LS_STREAM_V2_MAGIC { 'L', 'S', 2, 0 }   // v2 stream header magic
 
 typedef enum ls_frame_format
 {
@@ -14,13 +27,36 @@ typedef enum ls_frame_format
     ls_frame_Transition,        // previous frame update
                                 //  current frame displayed for 'duration' units then new frame is calculated
                                 //  process is repeated 'repeat' times                          
+    ls_frame_Index8,            // base frame data, 8-bit palette index per LED
+    ls_frame_Index4,            // base frame data, 4-bit palette index per LED
+    ls_frame_Index2,            // base frame data, 2-bit palette index per LED
+    ls_frame_Sparse,            // previous frame update of listed LEDs only
+                                //  same timing as ls_frame_Transition
+    ls_frame_Shift,             // previous frame shift/rotate along selected rows
+                                //  same timing as ls_frame_Transition
+    ls_frame_Gradient,          // base frame data, color stops interpolated along each row
+    ls_frame_LoopStart,         // control frame - beginning of loop body
+    ls_frame_LoopEnd,           // control frame - end of loop body
+    ls_frame_Jump,              // control frame - continue at another frame
+    ls_frame_Reference,         // base frame data of an earlier base frame
+    ls_frame_Program,           // base frame data calculated by a program
+                                //  program is run on every repetition of the frame
+    ls_frame_Effect,            // base frame data calculated by a built-in effect, see ls_fx_t
+                                //  effect is calculated on every repetition of the frame
+    ls_frame_Spawn,             // control frame - add particles to the particle layer
     ls_frame_FormatMax
 } ls_frame_format_t;
 
 // Show stream:
 //      - total length in 4-byte words not including first 4 bytes - 2 bytes LE - max size of the stream is 256K
 //      - refresh period - 1 byte (in LS_REFRESH_UNIT) - refresh period length = refresh_period * LS_REFRESH_UNIT
-//      - frame count - 1 byte (from 1 to LS_MAX_FRAME_COUNT)
+//      - frame count - 1 byte (from 1 to 127)
+//          - bit 7 (LS_STREAM_PALETTE) is set if the stream contains palette block
+//      - palette block (only if LS_STREAM_PALETTE is set)
+//          - palette size - 1 byte (1..255, 0 means LS_MAX_PALETTE_SIZE)
+//          - color 0 value - 3 bytes RR GG BB
+//          - color 1 value
+//          - color ...
 //      - frame 0
 //          - frame header:
 //              - frame duration - 2 bytes (in refresh periods)
@@ -51,10 +87,214 @@ typedef enum ls_frame_format
 //                      - each LED is updated individually as signed byte addition, carry is ignored
 //                      - total step duration is 'duration' * 'repeat count'
 //
+//              format ls_frame_Index8, ls_frame_Index4, ls_frame_Index2 - same as ls_frame_Base
+//                  but each led value is an index into the stream palette
+//                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+//                  - row 0 data:
+//                      - led count - 1 byte (1..LS_MAX_LED_COUNT)
+//                      - led indices - 8, 4 or 2 bits per led, first led in most significant bits,
+//                          row data is padded to whole bytes: (led count * bits + 7) / 8 bytes
+//                  - row 1 data:
+//                      - ...
+//                  Notes:
+//                      - stream must contain palette block, all indices must be less than palette size
+//                      - frame is expanded to the same RGB values as ls_frame_Base,
+//                          so it may be followed by ls_frame_Transition
+//
+//              format ls_frame_Sparse - contains LED update for selected leds of the last Base
+//                  - entry count - 2 bytes LE
+//                  - entry 0:
+//                      - row - 1 byte (less than row count of the last Base)
+//                      - led - 1 byte (less than led count of the row in the last Base)
+//                      - led update - 3 signed bytes
+//                  - entry 1
+//                  - ...
+//                  Notes:
+//                      - same as ls_frame_Transition except that leds not listed are not changed
+//
+//              format ls_frame_Shift - moves content of selected rows of the last Base
+//                  - row mask - 1 byte, bit N selects row N (rows must exist in the last Base)
+//                  - shift - 1 signed byte, positive value moves led values towards higher led index
+//                  - mode - 1 byte
+//                      - ls_shift_Rotate - leds shifted out of the row re-enter at the other end
+//                      - ls_shift_Fill - leds shifted into the row are set to fill value
+//                  - fill value - 3 bytes RR GG BB (present in both modes)
+//                  Notes:
+//                      - shift is applied every 'duration' refresh periods, 'repeat count' times
+//                      - rotation does not move led values, it only changes index of the first led
+//                          in the row buffer, so its cost does not depend on the row length
+//
+//              format ls_frame_Gradient - base frame generated from color stops
+//                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+//                  - row 0 data:
+//                      - led count - 1 byte (1..LS_MAX_LED_COUNT)
+//                      - stop count - 1 byte (1..led count)
+//                      - stop 0:
+//                          - led index - 1 byte
+//                          - color value - 3 bytes RR GG BB
+//                      - stop 1
+//                      - ...
+//                  - row 1 data:
+//                      - ...
+//                  Notes:
+//                      - stop led indices must be increasing and less than led count
+//                      - leds between stops are linearly interpolated,
+//                          leds before the first and after the last stop take the stop color
+//                      - frame may be followed by ls_frame_Transition like ls_frame_Base
+//
+//              control frames - do not produce pixels and take no time
+//                  - executed when the previous frame is finished, before the next frame is selected
+//                  - frame duration is ignored
+//
+//              format ls_frame_LoopStart - no data
+//                  - frame repeat count is the number of loop body iterations, 0 repeats forever
+//                  - loops may be nested up to LS_MAX_LOOP_DEPTH levels
+//
+//              format ls_frame_LoopEnd - no data
+//                  - ends body of the last open loop, body must contain at least one non-control frame
+//
+//              format ls_frame_Jump
+//                  - target frame number - 1 byte (less than frame count)
+//                  Notes:
+//                      - jump may leave loops but it can not enter a loop body from outside
+//
+//              format ls_frame_Spawn
+//                  - particle count - 1 byte (1..255)
+//                  - row - 1 byte (less than LS_MAX_ROW_COUNT)
+//                  - position - 1 byte (led index less than LS_MAX_LED_COUNT)
+//                  - velocity - 2 bytes LE signed (1/256 led per LS_REFRESH_UNIT)
+//                  - velocity spread - 2 bytes LE, each particle velocity differs by random value -spread..spread
+//                  - acceleration - 1 byte signed (1/4096 led per LS_REFRESH_UNIT, added every LS_REFRESH_UNIT)
+//                  - lifetime - 2 bytes LE (1..65535 LS_REFRESH_UNIT)
+//                  - color - 3 bytes RR GG BB
+//                  - decay - 1 byte, brightness lost every LS_REFRESH_UNIT in 1/16 steps, full brightness is 255
+//                  Notes:
+//                      - particles are added to the layer of the whole stream set, not to the stream frame,
+//                          they move with LS_REFRESH_UNIT regardless of stream refresh period
+//                      - particles that do not fit into LS_MAX_PARTICLE_COUNT pool are dropped
+//                      - particles are not added while seek calculates frames before the seek time
+//
+//              format ls_frame_Reference
+//                  - referenced frame number - 1 byte
+//                  Notes:
+//                      - referenced frame must precede this frame and must be ls_frame_Base, ls_frame_IndexN,
+//                          ls_frame_Gradient or ls_frame_Program, the frame is calculated again from its data
+//                      - frame may be followed by ls_frame_Transition like ls_frame_Base
+//
+//              format ls_frame_Program - base frame calculated by a program, see ls_vm_op_t
+//                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+//                  - led count of row 0 - 1 byte (1..LS_MAX_LED_COUNT)
+//                  - led count of row 1
+//                  - ...
+//                  - program length - 2 bytes LE (1..LS_VM_MAX_PROGRAM)
+//                  - program
+//                  Notes:
+//                      - program is run once for each led of each row, the led value is the last Out value,
+//                          leds without Out are black
+//                      - program is run again on every repetition, every 'duration' refresh periods
+//                      - jumps only go forward so each run executes every instruction at most once,
+//                          number of instructions * total led count must not exceed LS_VM_STEP_BUDGET
+//                      - frame may be followed by ls_frame_Transition like ls_frame_Base
+//
+//              format ls_frame_Effect - base frame calculated by a built-in effect
+//                  - row count - 1 byte (1..LS_MAX_ROW_COUNT)
+//                  - led count of row 0 - 1 byte (1..LS_MAX_LED_COUNT)
+//                  - led count of row 1
+//                  - ...
+//                  - effect - 1 byte (ls_fx_t)
+//                  - parameter length - 1 byte, must match the effect
+//                  - parameters
+//                  Notes:
+//                      - effect is calculated again on every repetition, every 'duration' refresh periods,
+//                          it only depends on stream time so it animates when 'duration' is 1
+//                      - frame may be followed by ls_frame_Transition like ls_frame_Base
+//
+//              Transition, Sparse and Shift frames are only applied on top of the Base frame
+//                  that precedes them in the stream, if a jump or loop reaches such frame
+//                  after different Base, the frame is skipped
+//
+//              all frames are validated when the stream is loaded, a stream with an invalid frame is not played
+//
 //              format X - TBD
 //      - frame 1
 //          - ...
 //      - frame ...
+//
+// Show stream v2 - same as v1 except:
+//      - stream header:
+//          - magic - 4 bytes LS_STREAM_V2_MAGIC, the last byte is 0 which is not a valid v1 frame count
+//          - total length in bytes including header - 4 bytes LE, 0 means the stream ends with the data
+//          - refresh period - 1 byte (in LS_REFRESH_UNIT)
+//          - flags - 1 byte, LS_STREAM_PALETTE if the stream contains palette block, other bits must be 0
+//          - frame count - 2 bytes LE (from 1 to LS_MAX_FRAME_COUNT)
+//          - row count - 1 byte, max row count of frames (0..LS_MAX_ROW_COUNT, 0 means LS_MAX_ROW_COUNT)
+//          - led count - 2 bytes LE, max led count of frame rows (0..LS_MAX_LED_COUNT, 0 means LS_MAX_LED_COUNT)
+//          - reserved - 1 byte, must be 0
+//      - led count, led index, stop count, shift and frame number fields in frame data are 2 bytes LE
+//      - led count may be up to LS_MAX_LED_COUNT even if it is more than 255
+//      - frames with more rows or leds than the header allows are invalid
+//
+// Frame buffers of a stream are sized by the largest row count and led count of its frames,
+//      three buffers per stream (one with LS_SINGLE_BUFFER) are taken from LS_ARENA_MEMORY
+
+// Program instructions:
+//      - opcode - 1 byte
+//      - register operands - 1 byte each (0..LS_VM_REG_COUNT-1), destination first
+//      - immediate operand, if any
+//  registers are signed 32-bit, arithmetic wraps around
+//  when the program starts for a led:
+//      - r0 - led index, r1 - led count of the row, r2 - row, r3 - stream time (in refresh periods)
+//      - r4..r7 - 0 for the first led of the row, keep values left by the previous led otherwise
+//  pixel values in registers are 00GGRRBB
+typedef enum ls_vm_op
+{
+    ls_op_End = 0,      // end program for this led
+    ls_op_Ldi,          // rd, imm - 2 bytes LE signed: rd = imm
+    ls_op_Mov,          // rd, ra: rd = ra
+    ls_op_Add,          // rd, ra, rb: rd = ra + rb
+    ls_op_Sub,          // rd, ra, rb: rd = ra - rb
+    ls_op_Mul,          // rd, ra, rb: rd = ra * rb
+    ls_op_And,          // rd, ra, rb: rd = ra & rb
+    ls_op_Or,           // rd, ra, rb: rd = ra | rb
+    ls_op_Xor,          // rd, ra, rb: rd = ra ^ rb
+    ls_op_Shl,          // rd, ra, rb: rd = ra << (rb & 31)
+    ls_op_Shr,          // rd, ra, rb: rd = ra >> (rb & 31), zeros shifted in
+    ls_op_Min,          // rd, ra, rb: rd = smaller of ra, rb
+    ls_op_Max,          // rd, ra, rb: rd = bigger of ra, rb
+    ls_op_Addi,         // rd, ra, imm - 1 byte signed: rd = ra + imm
+    ls_op_Sin,          // rd, ra: rd = 128 + 127 * sin(2 * pi * (ra & 255) / 256), 1..255
+    ls_op_Pal,          // rd, ra: rd = pixel of palette color ra modulo palette size, stream must have palette
+    ls_op_Rnd,          // rd: rd = next pseudo random number 0..65535
+    ls_op_Seed,         // ra: restart random numbers from ra,
+                        //  the generator is seeded from stream time and frame number when the frame starts
+    ls_op_Rgb,          // rd, ra, rb, rc: rd = pixel of R ra, G rb, B rc, each limited to 0..255
+    ls_op_Scale,        // rd, ra, rb: rd = pixel ra with each color multiplied by rb / 256, rb limited to 0..256
+    ls_op_Jz,           // ra, offset - 1 byte: skip 'offset' bytes after the instruction if ra is 0
+    ls_op_Jnz,          // ra, offset - 1 byte: skip 'offset' bytes after the instruction if ra is not 0
+    ls_op_Out,          // ra: led value = pixel ra
+    ls_op_Count
+} ls_vm_op_t;
+
+// Built-in effects and their parameters, speeds are per refresh period
+//  colors are 3 bytes RR GG BB, 'bright' scales the colors, 255 is full brightness
+typedef enum ls_fx
+{
+    ls_fx_Rainbow = 0,  // hue cycle - speed, hue step between leds, bright
+    ls_fx_Chase,        // theater chase - color, spacing (1..255 leds between lit leds), hold (1..255 refresh periods per step)
+    ls_fx_Twinkle,      // leds fade in and out at random - color, density (0..255 chance a led is lit), speed
+    ls_fx_Fire,         // flames rising from led 0 - cooling (brightness lost towards the row end), speed, scale (noise detail)
+    ls_fx_Breathe,      // whole row fades in and out - color, speed
+    ls_fx_Comet,        // moving head with fading tail - color, tail length (1..255 leds), speed (1/16 led)
+    ls_fx_Noise,        // flowing hue noise - speed, scale (noise detail), bright
+    ls_fx_Count
+} ls_fx_t;
+
+typedef enum ls_shift_mode
+{
+    ls_shift_Rotate = 0,
+    ls_shift_Fill,
+    ls_shift_ModeMax
+} ls_shift_mode_t;
 
 typedef struct ls_stream_header
 {
@@ -63,6 +303,18 @@ typedef struct ls_stream_header
     uint8_t count;
 } ls_stream_header_t;
 
+typedef struct ls_stream_header_v2
+{
+    uint8_t magic[4];
+    uint8_t length[4];
+    uint8_t refresh;
+    uint8_t flags;
+    uint8_t count[2];
+    uint8_t rows;
+    uint8_t leds[2];
+    uint8_t reserved;
+} ls_stream_header_v2_t;
+
 typedef struct ls_frame_header
 {
     uint8_t duration[2];
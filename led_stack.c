@@ -0,0 +1,88 @@
+#include <stdint.h>
+
+#include "nrf.h"
+
+#define NRF_LOG_LEVEL NRF_LOG_SEVERITY_INFO
+#include "nrf_log.h"
+
+#include "led_stack.h"
+
+#define STACK_PAINT 0xCDCDCDCD  // value of stack words that were never used
+#define STACK_MARGIN 64         // bytes below current stack pointer left unpainted
+
+// stack bounds defined by the linker script
+extern uint32_t __StackLimit[];
+extern uint32_t __StackTop[];
+
+#ifdef DEBUG
+static uint32_t probePeak[led_stack_ProbeCount];
+#endif
+
+void led_stack_paint()
+{
+    uint32_t* p = __StackLimit;
+    uint32_t* sp = (uint32_t*)(__get_MSP() - STACK_MARGIN);
+
+    // interrupts are not running yet, only this function uses the stack
+    while (p < sp)
+        *p++ = STACK_PAINT;
+}
+
+uint32_t led_stack_size()
+{
+    return (uint32_t)__StackTop - (uint32_t)__StackLimit;
+}
+
+uint32_t led_stack_high_water()
+{
+    const uint32_t* p = __StackLimit;
+
+    while (p < __StackTop && *p == STACK_PAINT)
+        p++;
+
+    return (uint32_t)__StackTop - (uint32_t)p;
+}
+
+void led_stack_cycles_start()
+{
+    if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0)
+    {
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    }
+}
+
+#ifdef DEBUG
+void led_stack_probe(led_stack_probe_t probe)
+{
+    uint32_t depth = (uint32_t)__StackTop - __get_MSP();
+
+    if (depth > probePeak[probe])
+        probePeak[probe] = depth;
+}
+
+uint32_t led_stack_peak(led_stack_probe_t probe)
+{
+    return probePeak[probe];
+}
+#endif
+
+void led_stack_log()
+{
+    NRF_LOG_INFO("Stack %d of %d bytes used", led_stack_high_water(), led_stack_size());
+
+#ifdef DEBUG
+    static const char* const name[led_stack_ProbeCount] =
+    {
+        [led_stack_Refresh] = "refresh",
+        [led_stack_Compute] = "compute",
+        [led_stack_Spim]    = "spim",
+        [led_stack_Usb]     = "usb",
+        [led_stack_Ble]     = "ble",
+    };
+
+    for (uint8_t i = 0; i < led_stack_ProbeCount; i++)
+        NRF_LOG_INFO("  %s peak %d", name[i], probePeak[i]);
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef LED_STACK_H
+#define LED_STACK_H
+
+#include <stdint.h>
+
+// stack usage - unused stack is painted at boot, words still painted were never used
+//  main and all interrupt handlers share the stack
+
+// paint unused stack, called first thing in main()
+void led_stack_paint();
+
+// stack size in bytes, __STACK_SIZE of the build
+uint32_t led_stack_size();
+
+// max stack bytes used since led_stack_paint()
+uint32_t led_stack_high_water();
+
+#ifdef DEBUG
+// handlers with stack probes
+typedef enum led_stack_probe
+{
+    led_stack_Refresh = 0,      // refresh timer - row composing and encoding
+    led_stack_Compute,          // frame calculation, refresh timer with LS_SINGLE_BUFFER
+    led_stack_Spim,             // SPIM transfer done
+    led_stack_Usb,              // USB CDC ACM events
+    led_stack_Ble,              // BLE events
+    led_stack_ProbeCount
+} led_stack_probe_t;
+
+// remember stack depth at a deep point of a handler
+void led_stack_probe(led_stack_probe_t probe);
+
+// max stack depth seen by probes of a handler, includes stack of code the handler interrupted
+uint32_t led_stack_peak(led_stack_probe_t probe);
+
+#define LED_STACK_PROBE(probe) led_stack_probe(probe)
+#else
+#define LED_STACK_PROBE(probe)
+#endif
+
+// start DWT cycle counter if not running yet, it is shared by profiles and boot timing and never stopped
+void led_stack_cycles_start();
+
+// log high water mark and probe peaks of debug builds
+void led_stack_log();
+
+#endif /*LED_STACK_H*/
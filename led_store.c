@@ -0,0 +1,427 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "nrf_error.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_atomic.h"
+#include "crc32.h"
+
+#define NRF_LOG_LEVEL NRF_LOG_SEVERITY_INFO
+#include "nrf_log.h"
+
+#include "led_ctlr.h"
+#include "led_store.h"
+
+#define STORE_PAGE 4096         // flash page size
+#define STORE_MAGIC 0x5353534C  // 'LSSS' - value of entry flags that are set
+#define STORE_ERASED 0xFFFFFFFF // value of erased flash word
+#define STORE_INVALID 0         // value of entry 'valid' if validation failed
+
+// directory entry, each word is written once
+//  offset, length, crc, id and name are written when the upload starts
+//  'valid' with 'geometry' and then 'complete' are written when the upload ends
+typedef struct store_entry
+{
+    uint32_t offset;            // show data offset from the region start, STORE_ERASED if the entry is unused
+    uint32_t length;            // show length in bytes
+    uint32_t crc;               // CRC-32 of show data
+    uint16_t id;
+    uint16_t reserved;
+    char name[LS_STORE_NAME_LENGTH];    // not terminated if all characters are used
+    uint32_t complete;          // STORE_MAGIC if all data was written and validated
+    uint32_t valid;             // STORE_MAGIC if CRC of flash content and all frames are valid, STORE_INVALID if not
+    uint32_t geometry;          // largest frame geometry found by validation, rows << 16 | leds
+} store_entry_t;
+
+#define STORE_DIR_SIZE (STORE_PAGE / sizeof(store_entry_t))   // directory entries
+
+// SHOW region of the linker script
+extern uint8_t __start_led_show[];
+extern uint8_t __stop_led_show[];
+
+// directory is the first page of the region
+#define storeDir ((const store_entry_t*)__start_led_show)
+
+static void storeEvent(nrf_fstorage_evt_t* evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t storeFlash) =
+{
+    .evt_handler = storeEvent,
+};
+
+static uint8_t entryCount;          // used directory entries
+static uint32_t nextAddr;           // first free page
+static nrf_atomic_u32_t pending;    // flash operations in progress
+static bool failed;                 // flash operation of current upload failed
+
+// upload in progress
+//  flash operations read data from these buffers after the API call returns
+static store_entry_t head;          // directory entry of the show being uploaded
+static bool uploading;
+static uint32_t received;           // bytes of show data received
+static uint32_t receivedCrc;        // CRC-32 of received data
+static uint32_t chunk[(LS_STORE_CHUNK + 3 + 3) / 4];    // data being written
+static uint8_t tail[4];             // received bytes that do not fill a flash word
+static uint8_t tailLength;
+
+static uint32_t pageAlign(uint32_t length)
+{
+    return (length + STORE_PAGE - 1) & ~(STORE_PAGE - 1);
+}
+
+static void storeEvent(nrf_fstorage_evt_t* evt)
+{
+    if (evt->result != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Flash operation %d at %x failed: %d", evt->id, evt->addr, evt->result);
+        failed = true;
+    }
+
+    nrf_atomic_u32_sub(&pending, 1);
+}
+
+// queue flash write of words from RAM buffer
+static int storeWrite(uint32_t addr, const void* src, uint32_t length)
+{
+    nrf_atomic_u32_add(&pending, 1);
+
+    int status = nrf_fstorage_write(&storeFlash, addr, src, length, NULL);
+    if (status != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Flash write at %x failed: %d", addr, status);
+        nrf_atomic_u32_sub(&pending, 1);
+        failed = true;
+    }
+
+    return status;
+}
+
+static int storeErase(uint32_t addr, uint32_t pages)
+{
+    nrf_atomic_u32_add(&pending, 1);
+
+    int status = nrf_fstorage_erase(&storeFlash, addr, pages, NULL);
+    if (status != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Flash erase at %x failed: %d", addr, status);
+        nrf_atomic_u32_sub(&pending, 1);
+    }
+
+    return status;
+}
+
+int led_store_init()
+{
+    int status;
+    uint32_t start = (uint32_t)__start_led_show;
+    uint32_t stop = (uint32_t)__stop_led_show;
+
+    storeFlash.start_addr = start;
+    storeFlash.end_addr = stop;
+
+    status = nrf_fstorage_init(&storeFlash, &nrf_fstorage_sd, NULL);
+    if (status != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Flash storage init failed: %d", status);
+        goto RetErr;
+    }
+
+    // entries are appended, the first unused one ends the directory
+    //  show pages follow the directory page in entry order
+    entryCount = 0;
+    nextAddr = start + STORE_PAGE;
+
+    while (entryCount < STORE_DIR_SIZE && storeDir[entryCount].offset != STORE_ERASED)
+    {
+        const store_entry_t* e = &storeDir[entryCount];
+
+        if (e->offset != nextAddr - start || e->length > stop - nextAddr)
+        {
+            NRF_LOG_ERROR("Show directory entry %d is invalid, show region must be cleared", entryCount);
+            nextAddr = stop;
+            break;
+        }
+
+        nextAddr += pageAlign(e->length);
+        entryCount++;
+    }
+
+    NRF_LOG_INFO("%d shows stored, %d bytes free", entryCount, stop - nextAddr);
+
+RetErr:
+    return status;
+}
+
+int led_store_begin(uint16_t id, const char* name, uint32_t length, uint32_t crc)
+{
+    int status = NRF_ERROR_BUSY;
+    uint32_t size = pageAlign(length);
+
+    if (uploading || led_store_busy())
+    {
+        NRF_LOG_ERROR("Show upload is in progress");
+        goto RetErr;
+    }
+
+    status = NRF_ERROR_NO_MEM;
+
+    if (entryCount >= STORE_DIR_SIZE || length == 0 || size > (uint32_t)__stop_led_show - nextAddr)
+    {
+        NRF_LOG_ERROR("Show of %d bytes does not fit, %d bytes free", length, (uint32_t)__stop_led_show - nextAddr);
+        goto RetErr;
+    }
+
+    status = storeErase(nextAddr, size / STORE_PAGE);
+    if (status != NRF_SUCCESS)
+        goto RetErr;
+
+    memset(&head, 0xFF, sizeof(head));
+    head.offset = nextAddr - (uint32_t)__start_led_show;
+    head.length = length;
+    head.crc = crc;
+    head.id = id;
+    strncpy(head.name, name, sizeof(head.name));
+
+    // directory entry and pages are used even if the upload does not complete
+    status = storeWrite((uint32_t)&storeDir[entryCount], &head, offsetof(store_entry_t, complete));
+    if (status != NRF_SUCCESS)
+        goto RetErr;
+
+    entryCount++;
+    nextAddr += size;
+    uploading = true;
+    failed = false;
+    received = 0;
+    receivedCrc = 0;
+    tailLength = 0;
+
+RetErr:
+    return status;
+}
+
+int led_store_write(const uint8_t* data, uint32_t length)
+{
+    if (!uploading)
+        return NRF_ERROR_INVALID_STATE;
+
+    if (length > LS_STORE_CHUNK || received + length > head.length)
+        return NRF_ERROR_INVALID_LENGTH;
+
+    // chunk buffer is reused when its write completes
+    if (led_store_busy())
+        return NRF_ERROR_BUSY;
+
+    uint8_t* c = (uint8_t*)chunk;
+    uint32_t n = tailLength + length;
+    uint32_t words = n & ~3;
+    uint32_t addr = (uint32_t)__start_led_show + head.offset + received - tailLength;
+
+    memcpy(c, tail, tailLength);
+    memcpy(c + tailLength, data, length);
+
+    tailLength = n - words;
+    memcpy(tail, c + words, tailLength);
+    received += length;
+    receivedCrc = crc32_compute(data, length, &receivedCrc);
+
+    // last word is padded with erased flash value
+    if (received == head.length && tailLength > 0)
+    {
+        memset(c + n, 0xFF, 4 - tailLength);
+        words += 4;
+    }
+
+    if (words == 0)
+        return NRF_SUCCESS;
+
+    return storeWrite(addr, chunk, words);
+}
+
+int led_store_end()
+{
+    int status = NRF_ERROR_INVALID_STATE;
+
+    if (!uploading || received != head.length)
+    {
+        NRF_LOG_ERROR("Show upload is incomplete, %d of %d bytes received", received, head.length);
+        goto RetErr;
+    }
+
+    status = NRF_ERROR_BUSY;
+    if (led_store_busy())
+        goto RetErr;
+
+    // entry stays incomplete, its pages are not used again until led_store_clear()
+    uploading = false;
+
+    if (failed)
+    {
+        NRF_LOG_ERROR("Show upload failed");
+        status = NRF_ERROR_INTERNAL;
+        goto RetErr;
+    }
+
+    if (receivedCrc != head.crc)
+    {
+        NRF_LOG_ERROR("Show CRC %08x does not match %08x", receivedCrc, head.crc);
+        status = NRF_ERROR_INVALID_DATA;
+        goto RetErr;
+    }
+
+    // all data is written, flash content and frames are checked once here
+    const uint8_t* data = __start_led_show + head.offset;
+
+    if (crc32_compute(data, head.length, NULL) != head.crc)
+    {
+        NRF_LOG_ERROR("Show CRC in flash does not match");
+        status = NRF_ERROR_INVALID_DATA;
+    }
+    else
+    {
+        uint8_t rowCount;
+        uint16_t ledCount;
+
+        status = led_ctlr_check(data, head.length, &rowCount, &ledCount);
+        head.geometry = ((uint32_t)rowCount << 16) | ledCount;
+    }
+
+    // entry buffer is free once the upload started, flags are written from it
+    //  flash writes are done in order, 'complete' follows the result
+    head.valid = (status == NRF_SUCCESS) ? STORE_MAGIC : STORE_INVALID;
+    head.complete = STORE_MAGIC;
+
+    if (storeWrite((uint32_t)&storeDir[entryCount - 1].valid, &head.valid, sizeof(head.valid) + sizeof(head.geometry)) != NRF_SUCCESS ||
+        storeWrite((uint32_t)&storeDir[entryCount - 1].complete, &head.complete, sizeof(head.complete)) != NRF_SUCCESS)
+    {
+        status = NRF_ERROR_INTERNAL;
+    }
+
+RetErr:
+    return status;
+}
+
+bool led_store_busy()
+{
+    return pending != 0;
+}
+
+uint8_t led_store_count()
+{
+    return entryCount;
+}
+
+int led_store_info(uint8_t show, led_store_info_t* info)
+{
+    if (show >= entryCount)
+        return NRF_ERROR_INVALID_PARAM;
+
+    const store_entry_t* e = &storeDir[show];
+
+    info->id = e->id;
+    memcpy(info->name, e->name, LS_STORE_NAME_LENGTH);
+    info->name[LS_STORE_NAME_LENGTH] = 0;
+    info->length = e->length;
+    info->crc = e->crc;
+    info->complete = e->complete == STORE_MAGIC;
+    info->validated = e->valid == STORE_MAGIC;
+    info->invalid = e->valid == STORE_INVALID;
+
+    return NRF_SUCCESS;
+}
+
+int led_store_find(uint16_t id, uint8_t* show)
+{
+    // later upload of the same id replaces earlier ones, directory is scanned from the latest entry
+    for (uint8_t i = entryCount; i > 0; i--)
+    {
+        const store_entry_t* e = &storeDir[i - 1];
+
+        if (e->id == id && e->complete == STORE_MAGIC && e->valid == STORE_MAGIC)
+        {
+            *show = i - 1;
+            return NRF_SUCCESS;
+        }
+    }
+
+    return NRF_ERROR_NOT_FOUND;
+}
+
+int led_store_get(uint8_t show, const uint8_t** data, uint32_t* length)
+{
+    if (show >= entryCount)
+        return NRF_ERROR_INVALID_PARAM;
+
+    const store_entry_t* e = &storeDir[show];
+
+    // the last entry is not complete before its flag is written
+    if (e->complete != STORE_MAGIC || (uploading && show == entryCount - 1))
+        return NRF_ERROR_NOT_FOUND;
+
+    *data = __start_led_show + e->offset;
+    *length = e->length;
+
+    return NRF_SUCCESS;
+}
+
+int led_store_play(uint8_t show, uint8_t stream)
+{
+    int status;
+    const uint8_t* data;
+    uint32_t length;
+
+    status = led_store_get(show, &data, &length);
+    if (status != NRF_SUCCESS)
+    {
+        NRF_LOG_ERROR("Show %d is not stored", show);
+        goto RetErr;
+    }
+
+    const store_entry_t* e = &storeDir[show];
+
+    // validated when the upload ended, frames are not walked again
+    if (e->valid != STORE_MAGIC)
+    {
+        NRF_LOG_ERROR("Show %d is invalid", show);
+        status = NRF_ERROR_INVALID_DATA;
+        goto RetErr;
+    }
+
+    status = led_ctlr_play_checked(stream, data, length, e->geometry >> 16, e->geometry & 0xFFFF);
+
+RetErr:
+    return status;
+}
+
+int led_store_clear()
+{
+    int status = NRF_ERROR_BUSY;
+    uint32_t start = (uint32_t)__start_led_show;
+
+    if (uploading || led_store_busy())
+    {
+        NRF_LOG_ERROR("Show upload is in progress");
+        goto RetErr;
+    }
+
+    // streams read show data from flash while they are played
+    if (led_ctlr_plays(__start_led_show, __stop_led_show - __start_led_show))
+    {
+        NRF_LOG_ERROR("Stored show is played, stream must be stopped first");
+        goto RetErr;
+    }
+
+    // erase directory and pages that were used
+    //  directory is kept if the erase was not queued, the next upload must not write over it
+    status = storeErase(start, (nextAddr - start) / STORE_PAGE);
+    if (status != NRF_SUCCESS)
+        goto RetErr;
+
+    entryCount = 0;
+    nextAddr = start + STORE_PAGE;
+
+RetErr:
+    return status;
+}
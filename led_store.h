@@ -0,0 +1,70 @@
+#ifndef LED_STORE_H
+#define LED_STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// show library in the flash region reserved by the linker script (SHOW region, __start_led_show..__stop_led_show)
+//  the first page of the region is the directory, one entry per uploaded show
+//  each show starts on a flash page boundary and is played from flash in place, see led_ctlr_play()
+//  shows are appended until the region or directory is full, led_store_clear() erases all of them
+//  flash operations are asynchronous, CPU is halted while a page is erased so playback may stall during upload
+#define LS_STORE_NAME_LENGTH 8  // max show name length
+#define LS_STORE_CHUNK 256      // max bytes written by one led_store_write() call
+#define LS_STORE_DEFAULT_ID 0   // id of the show played at boot instead of the test stream
+
+typedef struct led_store_info
+{
+    uint16_t id;
+    char name[LS_STORE_NAME_LENGTH + 1];
+    uint32_t length;            // show length in bytes
+    uint32_t crc;               // CRC-32 of show data
+    bool complete;              // all show data was written
+    bool validated;             // CRC and all frames were validated when the upload ended
+    bool invalid;               // validation failed
+} led_store_info_t;
+
+// find shows stored before reset
+int led_store_init();
+
+// start upload of a show of given length and CRC-32, erases flash pages for it
+//  name is truncated to LS_STORE_NAME_LENGTH characters
+//  returns NRF_SUCCESS, NRF_ERROR_NO_MEM if the show does not fit, NRF_ERROR_BUSY if an upload is in progress
+int led_store_begin(uint16_t id, const char* name, uint32_t length, uint32_t crc);
+
+// append show data, data is copied
+//  returns NRF_SUCCESS, NRF_ERROR_BUSY if previous chunk is still being written or NRF_ERROR_INVALID_LENGTH
+int led_store_write(const uint8_t* data, uint32_t length);
+
+// finish upload, show can be played once led_store_busy() returns false
+//  checks the CRC of flash content and validates all frames, the result is kept in the directory
+//  returns NRF_SUCCESS, NRF_ERROR_BUSY if previous chunk is still being written,
+//  NRF_ERROR_INVALID_DATA if the CRC does not match or the show is invalid or NRF_ERROR_INVALID_STATE
+int led_store_end();
+
+// flash operation in progress
+bool led_store_busy();
+
+// number of directory entries, including incomplete uploads
+uint8_t led_store_count();
+
+// directory entry of a show
+int led_store_info(uint8_t show, led_store_info_t* info);
+
+// directory entry of the latest complete and valid show with given id
+//  directory is scanned from the latest entry, up to one flash page of entries
+//  returns NRF_SUCCESS or NRF_ERROR_NOT_FOUND
+int led_store_find(uint16_t id, uint8_t* show);
+
+// show data in flash, valid until led_store_clear()
+int led_store_get(uint8_t show, const uint8_t** data, uint32_t* length);
+
+// play show on a stream slot, only shows validated by led_store_end() are played
+//  returns NRF_SUCCESS, NRF_ERROR_INVALID_DATA if the show is invalid or NRF_ERROR_NOT_FOUND if it is not complete
+int led_store_play(uint8_t show, uint8_t stream);
+
+// erase all shows
+//  returns NRF_SUCCESS or NRF_ERROR_BUSY during upload or while any stream plays a stored show, see led_ctlr_stop()
+int led_store_clear();
+
+#endif /*LED_STORE_H*/
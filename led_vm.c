@@ -0,0 +1,348 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "nrf_error.h"
+
+#define NRF_LOG_LEVEL NRF_LOG_SEVERITY_INFO
+#include "nrf_log.h"
+
+#include "led_vm.h"
+#include "led_stack.h"
+#include "led_ctlr_hw.h"
+
+#if LS_VM_PROFILE
+#include "nrf.h"
+#endif
+
+// instruction operands
+typedef struct vm_op_info
+{
+    uint8_t regs;       // number of register operands
+    uint8_t imm;        // immediate operand size in bytes
+} vm_op_info_t;
+
+static const vm_op_info_t opInfo[ls_op_Count] =
+{
+    [ls_op_End]   = { 0, 0 },
+    [ls_op_Ldi]   = { 1, 2 },
+    [ls_op_Mov]   = { 2, 0 },
+    [ls_op_Add]   = { 3, 0 },
+    [ls_op_Sub]   = { 3, 0 },
+    [ls_op_Mul]   = { 3, 0 },
+    [ls_op_And]   = { 3, 0 },
+    [ls_op_Or]    = { 3, 0 },
+    [ls_op_Xor]   = { 3, 0 },
+    [ls_op_Shl]   = { 3, 0 },
+    [ls_op_Shr]   = { 3, 0 },
+    [ls_op_Min]   = { 3, 0 },
+    [ls_op_Max]   = { 3, 0 },
+    [ls_op_Addi]  = { 2, 1 },
+    [ls_op_Sin]   = { 2, 0 },
+    [ls_op_Pal]   = { 2, 0 },
+    [ls_op_Rnd]   = { 1, 0 },
+    [ls_op_Seed]  = { 1, 0 },
+    [ls_op_Rgb]   = { 4, 0 },
+    [ls_op_Scale] = { 3, 0 },
+    [ls_op_Jz]    = { 1, 1 },
+    [ls_op_Jnz]   = { 1, 1 },
+    [ls_op_Out]   = { 1, 0 },
+};
+
+// Sin table, shared with effects
+// SIN = ROUND(128+127*SIN(2*PI*Index/256),0)
+const uint8_t led_vm_sin8[256] =
+{
+    128, 131, 134, 137, 140, 144, 147, 150, 153, 156, 159, 162, 165, 168, 171, 174,
+    177, 179, 182, 185, 188, 191, 193, 196, 199, 201, 204, 206, 209, 211, 213, 216,
+    218, 220, 222, 224, 226, 228, 230, 232, 234, 235, 237, 239, 240, 241, 243, 244,
+    245, 246, 248, 249, 250, 250, 251, 252, 253, 253, 254, 254, 254, 255, 255, 255,
+    255, 255, 255, 255, 254, 254, 254, 253, 253, 252, 251, 250, 250, 249, 248, 246,
+    245, 244, 243, 241, 240, 239, 237, 235, 234, 232, 230, 228, 226, 224, 222, 220,
+    218, 216, 213, 211, 209, 206, 204, 201, 199, 196, 193, 191, 188, 185, 182, 179,
+    177, 174, 171, 168, 165, 162, 159, 156, 153, 150, 147, 144, 140, 137, 134, 131,
+    128, 125, 122, 119, 116, 112, 109, 106, 103, 100,  97,  94,  91,  88,  85,  82,
+     79,  77,  74,  71,  68,  65,  63,  60,  57,  55,  52,  50,  47,  45,  43,  40,
+     38,  36,  34,  32,  30,  28,  26,  24,  22,  21,  19,  17,  16,  15,  13,  12,
+     11,  10,   8,   7,   6,   6,   5,   4,   3,   3,   2,   2,   2,   1,   1,   1,
+      1,   1,   1,   1,   2,   2,   2,   3,   3,   4,   5,   6,   6,   7,   8,  10,
+     11,  12,  13,  15,  16,  17,  19,  21,  22,  24,  26,  28,  30,  32,  34,  36,
+     38,  40,  43,  45,  47,  50,  52,  55,  57,  60,  63,  65,  68,  71,  74,  77,
+     79,  82,  85,  88,  91,  94,  97, 100, 103, 106, 109, 112, 116, 119, 122, 125,
+};
+
+#if LS_VM_PROFILE
+static uint32_t profCycles;     // cycles spent in programs since last report
+static uint32_t profSteps;      // instructions executed since last report
+static uint32_t profLeds;       // leds calculated since last report
+static uint32_t profRows;       // rows calculated since last report
+#endif
+
+int led_vm_verify(const uint8_t* code, uint16_t length, uint32_t ledCount, uint16_t paletteSize)
+{
+    int status = NRF_ERROR_INVALID_DATA;
+    uint8_t start[(LS_VM_MAX_PROGRAM + 1 + 7) / 8];    // bit N set if an instruction starts at offset N
+    uint16_t pc;
+    uint32_t count = 0;         // number of instructions
+
+    if (length == 0 || length > LS_VM_MAX_PROGRAM)
+    {
+        NRF_LOG_ERROR("Program length %d is invalid, allowed 1..%d", length, LS_VM_MAX_PROGRAM);
+        goto RetErr;
+    }
+
+    memset(start, 0, sizeof(start));
+
+    for (pc = 0; pc < length; )
+    {
+        uint8_t op = code[pc];
+
+        if (op >= ls_op_Count)
+        {
+            NRF_LOG_ERROR("Invalid opcode %d at %d", op, pc);
+            goto RetErr;
+        }
+
+        uint8_t size = 1 + opInfo[op].regs + opInfo[op].imm;
+
+        if (length - pc < size)
+        {
+            NRF_LOG_ERROR("Incomplete instruction %d at %d", op, pc);
+            goto RetErr;
+        }
+
+        for (uint8_t i = 1; i <= opInfo[op].regs; i++)
+        {
+            if (code[pc + i] >= LS_VM_REG_COUNT)
+            {
+                NRF_LOG_ERROR("Invalid register %d at %d", code[pc + i], pc);
+                goto RetErr;
+            }
+        }
+
+        if (op == ls_op_Pal && paletteSize == 0)
+        {
+            NRF_LOG_ERROR("Palette lookup at %d but stream has no palette", pc);
+            goto RetErr;
+        }
+
+        start[pc / 8] |= 1 << (pc % 8);
+        pc += size;
+        count++;
+    }
+
+    // program may end without End instruction
+    start[pc / 8] |= 1 << (pc % 8);
+
+    // jumps only go forward to an instruction or to the end of the program
+    for (pc = 0; pc < length; pc += 1 + opInfo[code[pc]].regs + opInfo[code[pc]].imm)
+    {
+        if (code[pc] != ls_op_Jz && code[pc] != ls_op_Jnz)
+            continue;
+
+        uint16_t target = pc + 3 + code[pc + 2];
+
+        if (target > length || (start[target / 8] & (1 << (target % 8))) == 0)
+        {
+            NRF_LOG_ERROR("Jump target %d at %d is invalid", target, pc);
+            goto RetErr;
+        }
+    }
+
+    // each instruction runs at most once per led
+    if (count * ledCount > LS_VM_STEP_BUDGET)
+    {
+        NRF_LOG_ERROR("Program of %d instructions for %d leds exceeds budget %d", count, ledCount, LS_VM_STEP_BUDGET);
+        goto RetErr;
+    }
+
+    status = NRF_SUCCESS;
+
+RetErr:
+    return status;
+}
+
+static uint8_t clamp8(int32_t v)
+{
+    return (v < 0) ? 0 : (v > 255) ? 255 : v;
+}
+
+// xorshift32, state must not be 0
+static uint16_t random16(led_vm_ctx_t* ctx)
+{
+    uint32_t x = ctx->random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    ctx->random = x;
+
+    return x >> 16;
+}
+
+void led_vm_row(const uint8_t* code, uint16_t length, led_vm_ctx_t* ctx, uint8_t row, uint32_t* r, uint16_t ledCount)
+{
+    int32_t reg[LS_VM_REG_COUNT];
+    const uint8_t* end = code + length;
+
+    LED_STACK_PROBE(led_stack_Compute);
+
+#if LS_VM_PROFILE
+    led_stack_cycles_start();
+    uint32_t cycles = DWT->CYCCNT;
+#endif
+
+    if (ctx->random == 0)
+        ctx->random = 1;
+
+    memset(reg, 0, sizeof(reg));
+
+    for (uint16_t led = 0; led < ledCount; led++)
+    {
+        const uint8_t* p = code;
+        uint32_t out = 0;
+
+        reg[0] = led;
+        reg[1] = ledCount;
+        reg[2] = row;
+        reg[3] = ctx->time;
+
+        // program was validated by led_vm_verify()
+        while (p < end)
+        {
+            uint8_t op = *p++;
+            int32_t a = 0;
+            int32_t b = 0;
+
+#if LS_VM_PROFILE
+            profSteps++;
+#endif
+
+            if (opInfo[op].regs > 1)
+                a = reg[p[1]];
+            if (opInfo[op].regs > 2)
+                b = reg[p[2]];
+
+            switch (op)
+            {
+            case ls_op_End:
+                p = end;
+                continue;
+
+            case ls_op_Ldi:
+                reg[p[0]] = (int16_t)(p[1] | ((uint16_t)p[2] << 8));
+                break;
+
+            case ls_op_Mov:
+                reg[p[0]] = a;
+                break;
+
+            case ls_op_Add:
+                reg[p[0]] = (uint32_t)a + (uint32_t)b;
+                break;
+
+            case ls_op_Sub:
+                reg[p[0]] = (uint32_t)a - (uint32_t)b;
+                break;
+
+            case ls_op_Mul:
+                reg[p[0]] = (uint32_t)a * (uint32_t)b;
+                break;
+
+            case ls_op_And:
+                reg[p[0]] = a & b;
+                break;
+
+            case ls_op_Or:
+                reg[p[0]] = a | b;
+                break;
+
+            case ls_op_Xor:
+                reg[p[0]] = a ^ b;
+                break;
+
+            case ls_op_Shl:
+                reg[p[0]] = (uint32_t)a << (b & 31);
+                break;
+
+            case ls_op_Shr:
+                reg[p[0]] = (uint32_t)a >> (b & 31);
+                break;
+
+            case ls_op_Min:
+                reg[p[0]] = (a < b) ? a : b;
+                break;
+
+            case ls_op_Max:
+                reg[p[0]] = (a > b) ? a : b;
+                break;
+
+            case ls_op_Addi:
+                reg[p[0]] = (uint32_t)a + (uint32_t)(int8_t)p[2];
+                break;
+
+            case ls_op_Sin:
+                reg[p[0]] = led_vm_sin8[a & 0xFF];
+                break;
+
+            case ls_op_Pal:
+            {
+                const uint8_t* c = ctx->palette + ((uint32_t)a % ctx->paletteSize) * 3;
+                reg[p[0]] = PIXEL(c[0], c[1], c[2]);
+                break;
+            }
+
+            case ls_op_Rnd:
+                reg[p[0]] = random16(ctx);
+                break;
+
+            case ls_op_Seed:
+                ctx->random = (reg[p[0]] != 0) ? (uint32_t)reg[p[0]] : 1;
+                break;
+
+            case ls_op_Rgb:
+                reg[p[0]] = PIXEL(clamp8(a), clamp8(b), clamp8(reg[p[3]]));
+                break;
+
+            case ls_op_Scale:
+            {
+                uint32_t k = (b < 0) ? 0 : (b > 256) ? 256 : b;
+
+                reg[p[0]] = led_pixel_scale(a, k);
+                break;
+            }
+
+            case ls_op_Jz:
+                if (reg[p[0]] == 0)
+                    p += p[1];
+                break;
+
+            case ls_op_Jnz:
+                if (reg[p[0]] != 0)
+                    p += p[1];
+                break;
+
+            case ls_op_Out:
+                out = (uint32_t)reg[p[0]] & 0x00FFFFFF;
+                break;
+            }
+
+            p += opInfo[op].regs + opInfo[op].imm;
+        }
+
+        r[led] = out;
+    }
+
+#if LS_VM_PROFILE
+    profCycles += DWT->CYCCNT - cycles;
+    profLeds += ledCount;
+
+    if (++profRows >= LS_VM_PROFILE_ROWS)
+    {
+        NRF_LOG_INFO("VM: %d cycles/led  %d steps/led", profCycles / profLeds, profSteps / profLeds);
+        profCycles = 0;
+        profSteps = 0;
+        profLeds = 0;
+        profRows = 0;
+    }
+#endif
+}
@@ -0,0 +1,31 @@
+#ifndef LED_VM_H
+#define LED_VM_H
+
+#include "led_show.h"
+
+// set to 1 to measure program cost with DWT cycle counter, average is logged every LS_VM_PROFILE_ROWS rows
+#ifndef LS_VM_PROFILE
+#define LS_VM_PROFILE 0
+#endif
+#define LS_VM_PROFILE_ROWS 1024
+
+// program run environment, see ls_vm_op_t
+typedef struct led_vm_ctx
+{
+    const uint8_t* palette;     // 3 bytes per color
+    uint16_t paletteSize;       // number of colors in palette, 0 if there is no palette
+    uint32_t time;              // stream time, r3
+    uint32_t random;            // random generator state, initialized by caller
+} led_vm_ctx_t;
+
+// sine table, 128 + 127 * sin(2 * pi * index / 256)
+extern const uint8_t led_vm_sin8[256];
+
+// validate program that is run for ledCount leds in total
+//  returns NRF_SUCCESS or NRF_ERROR_INVALID_DATA
+int led_vm_verify(const uint8_t* code, uint16_t length, uint32_t ledCount, uint16_t paletteSize);
+
+// run validated program for each led of a row, store led values (00GGRRBB) to r
+void led_vm_row(const uint8_t* code, uint16_t length, led_vm_ctx_t* ctx, uint8_t row, uint32_t* r, uint16_t ledCount);
+
+#endif /*LED_VM_H*/
@@ -87,6 +87,9 @@
 #include "app_usbd_serial_num.h"
 
 #include "led_ctlr.h"
+#include "led_stack.h"
+#include "led_store.h"
+#include "led_resume.h"
 
 #define LED_BLE_NUS_CONN (BSP_BOARD_LED_0)
 #define LED_BLE_NUS_RX   (BSP_BOARD_LED_1)
@@ -175,6 +178,22 @@ static ble_uuid_t m_adv_uuids[]          =
 };
 static char m_nus_data_array[BLE_NUS_MAX_DATA_LEN];
 
+// show commands, BLE NUS packets that start with SHOW_CMD_PREFIX byte followed by command byte
+//  'B' id(2) length(4) crc(4) name - start upload, see led_store_begin(), little endian
+//  'W' data                         - append up to LS_STORE_CHUNK bytes of show data
+//  'E'                              - finish upload
+//  'P' id(2)                        - play the latest show with id on stream 0
+//  'S'                              - stop stream 0
+//  'C'                              - erase all shows, stream 0 must be stopped if it plays one
+//  each command is answered by the command byte and 2 byte status (NRF_SUCCESS or NRF_ERROR_*),
+//  NRF_ERROR_BUSY means the command was not done and should be sent again
+//  other packets are passed to CDC ACM
+#define SHOW_CMD_PREFIX 0
+
+// command is executed in the main loop, flash and stream operations must not preempt frame calculation
+static uint8_t m_show_cmd[BLE_NUS_MAX_DATA_LEN];
+static volatile uint16_t m_show_cmd_length;                                         /**< Length of the command to execute, 0 if none. */
+
 // BLE DEFINES END
 
 /**
@@ -236,16 +255,116 @@ static void gap_params_init(void)
 }
 
 
+/** @brief Function for answering a show command with its status. */
+static void show_command_reply(uint8_t cmd, int status)
+{
+    uint8_t reply[3] = { cmd, status & 0xFF, (status >> 8) & 0xFF };
+    uint16_t length = sizeof(reply);
+
+    ret_code_t ret = ble_nus_data_send(&m_nus, reply, &length, m_conn_handle);
+    if (ret != NRF_SUCCESS)
+    {
+        NRF_LOG_INFO("BLE NUS unavailable, show command %c status %d", cmd, status);
+    }
+}
+
+
+/** @brief Function for executing show command received from BLE NUS, called from the main loop. */
+static void show_command_process(void)
+{
+    uint8_t cmd = m_show_cmd[1];
+    const uint8_t* p = m_show_cmd + 2;
+    uint16_t length = m_show_cmd_length - 2;
+    int status = NRF_ERROR_INVALID_LENGTH;
+    uint8_t show;
+
+    switch (cmd)
+    {
+        case 'B':
+            if (length >= 10)
+            {
+                char name[LS_STORE_NAME_LENGTH + 1] = { 0 };
+                uint16_t name_length = length - 10;
+                if (name_length > LS_STORE_NAME_LENGTH)
+                {
+                    name_length = LS_STORE_NAME_LENGTH;
+                }
+                memcpy(name, p + 10, name_length);
+
+                status = led_store_begin(uint16_decode(p), name, uint32_decode(p + 2), uint32_decode(p + 6));
+            }
+            break;
+
+        case 'W':
+            status = led_store_write(p, length);
+            break;
+
+        case 'E':
+            status = led_store_end();
+            break;
+
+        case 'P':
+            if (length >= 2)
+            {
+                uint16_t id = uint16_decode(p);
+
+                status = led_store_find(id, &show);
+                if (status == NRF_SUCCESS)
+                {
+                    status = led_store_play(show, 0);
+                }
+                if (status == NRF_SUCCESS)
+                {
+                    led_resume_start(id);
+                }
+            }
+            break;
+
+        case 'S':
+            status = led_ctlr_stop(0);
+            led_resume_start(LS_RESUME_NO_SHOW);
+            break;
+
+        case 'C':
+            status = led_store_clear();
+            break;
+
+        default:
+            status = NRF_ERROR_NOT_SUPPORTED;
+            break;
+    }
+
+    m_show_cmd_length = 0;
+    show_command_reply(cmd, status);
+}
+
+
 /**
  * @brief Function for handling the data from the Nordic UART Service.
  *
  * @details This function will process the data received from the Nordic UART BLE Service and send
- *          it to the USBD CDC ACM module.
+ *          it to the USBD CDC ACM module. Show commands are passed to the main loop.
  *
  * @param[in] p_evt Nordic UART Service event.
  */
 static void nus_data_handler(ble_nus_evt_t * p_evt)
 {
+    LED_STACK_PROBE(led_stack_Ble);
+
+    if (p_evt->type == BLE_NUS_EVT_RX_DATA &&
+        p_evt->params.rx_data.length >= 2 && p_evt->params.rx_data.p_data[0] == SHOW_CMD_PREFIX)
+    {
+        // previous command was not executed yet
+        if (m_show_cmd_length != 0)
+        {
+            show_command_reply(p_evt->params.rx_data.p_data[1], NRF_ERROR_BUSY);
+            return;
+        }
+
+        memcpy(m_show_cmd, p_evt->params.rx_data.p_data, p_evt->params.rx_data.length);
+        m_show_cmd_length = p_evt->params.rx_data.length;
+        return;
+    }
 
     if (p_evt->type == BLE_NUS_EVT_RX_DATA)
     {
@@ -388,6 +507,8 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
 {
     uint32_t err_code;
 
+    LED_STACK_PROBE(led_stack_Ble);
+
     switch (p_ble_evt->header.evt_id)
     {
         case BLE_GAP_EVT_CONNECTED:
@@ -661,6 +782,8 @@ static void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst,
 {
     app_usbd_cdc_acm_t const * p_cdc_acm = app_usbd_cdc_acm_class_get(p_inst);
 
+    LED_STACK_PROBE(led_stack_Usb);
+
     switch (event)
     {
         case APP_USBD_CDC_ACM_USER_EVT_PORT_OPEN:
@@ -765,6 +888,8 @@ static void cdc_acm_user_ev_handler(app_usbd_class_inst_t const * p_inst,
 
 static void usbd_user_ev_handler(app_usbd_event_type_t event)
 {
+    LED_STACK_PROBE(led_stack_Usb);
+
     switch (event)
     {
         case APP_USBD_EVT_DRV_SUSPEND:
@@ -819,6 +944,55 @@ static void usbd_user_ev_handler(app_usbd_event_type_t event)
 
 // USB CODE END
 
+static uint16_t m_show_id = LS_RESUME_NO_SHOW;                                     /**< Show played on stream 0. */
+static bool m_show_resume;                                                          /**< Show continues from a checkpoint. */
+static led_resume_point_t m_resume_point;                                           /**< Checkpoint found at boot. */
+
+/** @brief Function for starting the show played before reset, or the default show if there is no checkpoint.
+ *         The test stream plays if there is no default show. Stored shows were validated when uploaded,
+ *         only the stream header is parsed here and the first frame is calculated.
+ */
+static void show_init(void)
+{
+    uint8_t show;
+    bool resume = led_resume_init() == NRF_SUCCESS && led_resume_get(&m_resume_point) == NRF_SUCCESS;
+
+    if (led_store_init() == NRF_SUCCESS)
+    {
+        if (resume && led_store_find(m_resume_point.id, &show) == NRF_SUCCESS && led_store_play(show, 0) == NRF_SUCCESS)
+            m_show_id = m_resume_point.id;
+        else if (led_store_find(LS_STORE_DEFAULT_ID, &show) == NRF_SUCCESS && led_store_play(show, 0) == NRF_SUCCESS)
+            m_show_id = LS_STORE_DEFAULT_ID;
+    }
+
+    m_show_resume = resume && m_resume_point.id == m_show_id;
+}
+
+
+/** @brief Function for continuing the show from its checkpoint, called after the first frame was sent.
+ *         The seek builds the time index, that walks at most LS_TIME_WALK_LIMIT frame headers,
+ *         then walks headers from the closest indexed Base frame and calculates frames after the last one.
+ */
+static void show_resume(void)
+{
+    // frame and repeat counter follow from time
+    if (m_show_resume)
+    {
+        NRF_LOG_INFO("Show %d resumed at %d ms, frame %d repeat %d",
+                     m_show_id, m_resume_point.time, m_resume_point.frame, m_resume_point.repeat);
+#if NRF_LOG_ENABLED
+        uint32_t start = DWT->CYCCNT;
+#endif
+        led_ctlr_seek(m_resume_point.time);
+#if NRF_LOG_ENABLED
+        NRF_LOG_INFO("Resume seek took %d us", (DWT->CYCCNT - start) / (SystemCoreClock / 1000000));
+#endif
+    }
+
+    led_resume_start(m_show_id);
+}
+
+
 /** @brief Application main function. */
 int main(void)
 {
@@ -826,17 +1000,44 @@ int main(void)
     static const app_usbd_config_t usbd_config = {
         .ev_state_proc = usbd_user_ev_handler
     };
+
+    // stack high water mark is measured from here
+    led_stack_paint();
+
+#if NRF_LOG_ENABLED
+    // time to first pixel is measured from here, cycle counter is only used for the log
+    //  a debugger may keep the counter running across reset, so it is not assumed to start at 0
+    led_stack_cycles_start();
+    uint32_t boot_start = DWT->CYCCNT;
+#endif
+
     // Initialize.
     log_init();
     timers_init();
 
+    ret = nrf_drv_clock_init();
+    APP_ERROR_CHECK(ret);
+
+    // refresh timer needs low frequency clock, SoftDevice takes it over when enabled
+    nrf_drv_clock_lfclk_request(NULL);
+
+    // LEDs show the default show before USB and BLE are brought up
+    //  time to first frame is the directory scan, stream header parse and first frame of the show,
+    //  no frames are walked before it, resume seek follows
+    led_ctlr_init(led_ctlr_NeoPixel);
+    show_init();
+    led_ctlr_start();
+
+#if NRF_LOG_ENABLED
+    NRF_LOG_INFO("First frame sent %d us after reset", (DWT->CYCCNT - boot_start) / (SystemCoreClock / 1000000));
+#endif
+
+    show_resume();
+
     buttons_leds_init();
 
     app_usbd_serial_num_generate();
 
-    ret = nrf_drv_clock_init();
-    APP_ERROR_CHECK(ret);
-
     NRF_LOG_INFO("LED Controller start.");
 
     ret = app_usbd_init(&usbd_config);
@@ -852,15 +1053,15 @@ int main(void)
     services_init();
     advertising_init();
     conn_params_init();
-    led_ctlr_init(led_ctlr_NeoPixel);
 
     // Start execution.
     advertising_start();
-    led_ctlr_start();
 
     ret = app_usbd_power_events_enable();
     APP_ERROR_CHECK(ret);
 
+    led_stack_log();
+
     // Enter main loop.
     for (;;)
     {
@@ -868,6 +1069,10 @@ int main(void)
         {
             /* Nothing to do */
         }
+        if (m_show_cmd_length != 0)
+        {
+            show_command_process();
+        }
         idle_state_handle();
     }
 }
@@ -0,0 +1,239 @@
+#!/usr/bin/env python3
+# RAM and flash budget of the armgcc build
+#  usage: ram_report.py <map file> <linker script> <led_show.h>
+#
+#  lists RAM taken by led_ctlr symbols and by other parts of the firmware,
+#  then estimates max LS_MAX_LED_COUNT that fits the RAM region for each
+#  combination of encoding and pixel storage (LS_PIXEL_PACKED), and the number of streams
+#  of max geometry that fit the frame buffer arena (LS_ARENA_MEMORY) for each pixel storage
+#  and frame buffer count (LS_SINGLE_BUFFER)
+#
+#  snapshot budget LS_SNAPSHOT_MEMORY is read from led_ctlr.c next to led_show.h, it must hold
+#  at least one snapshot of max geometry, above that led count the build fails unless it is raised,
+#  snapshot size is the size of led_ctlr_snapshot_size listed with discarded sections of the map
+
+import os
+import re
+import sys
+
+# led_ctlr objects, symbols of other objects are reported by group
+LED_OBJECTS = ('led_ctlr.c.o', 'led_ctlr_hw.c.o', 'led_vm.c.o', 'led_fx.c.o', 'led_particle.c.o', 'led_stack.c.o', 'led_store.c.o', 'led_resume.c.o', 'main.c.o')
+
+GROUPS = (
+    ('USB', re.compile(r'usbd|usb_')),
+    ('BLE', re.compile(r'ble|nrf_sdh|peer_manager|gatt')),
+    ('log', re.compile(r'nrf_log|nrf_fprintf|nrf_strerror')),
+)
+
+# bytes per led of each output row buffer of the hw driver
+ENCODINGS = (
+    ('NeoPixel', 15),       # 5 SPI bits per data bit
+    ('DotStar', 4),         # global brightness + 3 colors, led_ctlr_hw has no DotStar driver yet
+)
+
+# pixel storage, pixel size
+PIXELS = (
+    ('32-bit', 4),
+    ('packed', 3),
+)
+
+# frame buffers per stream, pixel size
+STORAGES = (
+    ('32-bit  triple', 3, 4),
+    ('packed  triple', 3, 3),
+    ('32-bit  single', 1, 4),
+    ('packed  single', 1, 3),
+)
+
+SYMBOL = re.compile(r'^ \.(bss|data)\.(\S+)\s*(?:\n\s+)?(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S+)', re.M)
+COMMON = re.compile(r'^ COMMON\s+(0x[0-9a-f]+)\s+(0x[0-9a-f]+)\s+(\S+)', re.M)
+SECTION = re.compile(r'^(\.[\w.]+)\s*(?:\n\s+)?(0x[0-9a-f]+)\s+(0x[0-9a-f]+)', re.M)
+ASSIGN = re.compile(r'^\s+(0x[0-9a-f]+)\s+(__\w+) = ', re.M)
+REGION = re.compile(r'^\s*(\w+)\s*\(\w+\)\s*:\s*ORIGIN\s*=\s*(\w+)\s*,\s*LENGTH\s*=\s*(\w+)', re.M)
+DEFINE = re.compile(r'^#define\s+(LS_MAX_\w+)\s+(\w+)', re.M)
+SNAPSHOT_MEMORY = re.compile(r'^#define\s+LS_SNAPSHOT_MEMORY\s+(\w+)', re.M)
+SNAPSHOT_SIZE = re.compile(r'^ \.rodata\.led_ctlr_snapshot_size\s*(?:\n\s+)?(0x[0-9a-f]+)\s+(0x[0-9a-f]+)', re.M)
+
+
+def fail(msg):
+    sys.stderr.write('ram_report: %s\n' % msg)
+    sys.exit(1)
+
+
+def read(path):
+    try:
+        with open(path) as f:
+            return f.read()
+    except OSError as e:
+        fail(str(e))
+
+
+def regions(ld):
+    r = {}
+    for name, origin, length in REGION.findall(ld):
+        r[name] = (int(origin, 0), int(length, 0))
+    if 'RAM' not in r or 'FLASH' not in r:
+        fail('RAM or FLASH region not found in linker script')
+    return r
+
+
+def limits(header):
+    d = {}
+    for name, value in DEFINE.findall(header):
+        d[name] = value
+    # LS_MAX_STREAM_COUNT refers to LS_MAX_ROW_COUNT
+    for name, value in d.items():
+        if value in d:
+            d[name] = d[value]
+    try:
+        return {k: int(v, 0) for k, v in d.items() if k in
+                ('LS_MAX_ROW_COUNT', 'LS_MAX_LED_COUNT', 'LS_MAX_STREAM_COUNT', 'LS_MAX_LAYER_COUNT')}
+    except ValueError:
+        fail('LS_MAX_ limits in led_show.h are not numbers')
+
+
+def symbols(layout, ram):
+    base, length = ram
+    syms = []
+    for kind, name, addr, size, obj in SYMBOL.findall(layout):
+        if base <= int(addr, 16) < base + length:
+            syms.append((name, obj.split('/')[-1].split('\\')[-1], int(size, 16)))
+    for addr, size, obj in COMMON.findall(layout):
+        if base <= int(addr, 16) < base + length:
+            syms.append(('(common)', obj.split('/')[-1].split('\\')[-1], int(size, 16)))
+    return syms
+
+
+def main():
+    if len(sys.argv) != 4:
+        fail('usage: ram_report.py <map file> <linker script> <led_show.h>')
+
+    mapfile = read(sys.argv[1])
+    mem = regions(read(sys.argv[2]))
+    lim = limits(read(sys.argv[3]))
+
+    m = SNAPSHOT_MEMORY.search(read(os.path.join(os.path.dirname(sys.argv[3]), 'led_ctlr.c')))
+    if m is None:
+        fail('LS_SNAPSHOT_MEMORY not found in led_ctlr.c')
+    snapshot_memory = int(m.group(1), 0)
+
+    # only the layout part of the map, discarded sections are listed before it
+    start = mapfile.find('Linker script and memory map')
+    if start < 0:
+        fail('%s is not a GNU ld map file' % sys.argv[1])
+    layout = mapfile[start:]
+
+    sym = {name: int(addr, 16) for addr, name in ASSIGN.findall(layout)}
+    for name in ('__HeapLimit', '__StackLimit', '__StackTop'):
+        if name not in sym:
+            fail('%s not found in map file' % name)
+
+    ram_base, ram_length = mem['RAM']
+    flash_base, flash_length = mem['FLASH']
+
+    # flash holds output sections located in it and initial values of .data
+    flash_used = 0
+    data_size = 0
+    for name, addr, size in SECTION.findall(layout):
+        a = int(addr, 16)
+        if flash_base <= a < flash_base + flash_length:
+            flash_used += int(size, 16)
+        elif name == '.data':
+            data_size = int(size, 16)
+    flash_used += data_size
+
+    static = sym['__HeapLimit'] - ram_base
+    stack = sym['__StackTop'] - sym['__StackLimit']
+    free = sym['__StackLimit'] - sym['__HeapLimit']
+
+    print('FLASH  0x%05x  %7d bytes  used %7d  free %7d' % (flash_base, flash_length, flash_used, flash_length - flash_used))
+    print('RAM    0x%08x  %5d bytes  static + heap %7d  stack %5d  free %7d' % (ram_base, ram_length, static, stack, free))
+    print('')
+
+    syms = symbols(layout, mem['RAM'])
+    led = sorted([s for s in syms if s[1] in LED_OBJECTS], key=lambda s: -s[2])
+    other = [s for s in syms if s[1] not in LED_OBJECTS]
+
+    print('led_ctlr symbols')
+    for name, obj, size in led:
+        if size >= 16:
+            print('  %-24s %-18s %7d' % (name, obj, size))
+    print('  %-43s %7d' % ('total', sum(s[2] for s in led)))
+    print('')
+
+    print('other symbols')
+    rest = 0
+    for group, pattern in GROUPS:
+        n = sum(s[2] for s in other if pattern.search(s[1]))
+        print('  %-43s %7d' % (group, n))
+        rest += n
+    print('  %-43s %7d' % ('rest', sum(s[2] for s in other) - rest))
+    print('')
+
+    # RAM that grows with LS_MAX_LED_COUNT
+    #  composed output rows, host layer pixels, packed row scratch, hw row buffers
+    #  frame buffer arena has its own budget, snapshots too while one of them fits it
+    leds = lim['LS_MAX_LED_COUNT']
+    rows = lim['LS_MAX_ROW_COUNT']
+    streams = lim['LS_MAX_STREAM_COUNT']
+    layers = lim['LS_MAX_LAYER_COUNT']
+
+    size = {name: n for name, obj, n in led}
+    for name in ('arena', 'rowOut', 'layers', 'hw_NeoPixel'):
+        if name not in size:
+            fail('symbol %s not found, build with -fdata-sections' % name)
+
+    hw_rows = size['hw_NeoPixel'] // (15 * leds + 2)
+    scaled = size['rowOut'] + layers * rows * leds * 4 + size.get('rowWide', 0) + hw_rows * (15 * leds + 2)
+    fixed = static + stack - scaled
+
+    print('LS_MAX_LED_COUNT %d  rows %d  streams %d  layers %d  frame buffer arena %d' %
+          (leds, rows, streams, layers, size['arena']))
+    print('RAM independent of led count %d, hw row buffers %d' % (fixed, hw_rows))
+    print('')
+
+    # above the snapshot limit LS_SNAPSHOT_MEMORY must be raised to one snapshot, it then grows with led count
+    #  snapshot header is stream_snapshot_t without the frame of the build pixel storage, rowWide is packed only
+    snapshots = size.get('snapshots', 0)
+    snapshot_header = 0
+    snapshot_limit = {}
+    if snapshot_memory > 0:
+        m = SNAPSHOT_SIZE.search(mapfile[:start])
+        if m is None:
+            fail('led_ctlr_snapshot_size not found in discarded sections, build with --gc-sections')
+        snapshot_size = int(m.group(2), 16)
+        snapshot_header = snapshot_size - rows * leds * (3 if 'rowWide' in size else 4)
+        print('LS_SNAPSHOT_MEMORY %d  snapshots %d of %d bytes' % (snapshot_memory, snapshots // snapshot_size, snapshot_size))
+        for storage, px in PIXELS:
+            snapshot_limit[px] = max(0, (snapshot_memory - snapshot_header) // (rows * px))
+            print('  %-16sone snapshot up to %d leds, build fails above (LS_SNAPSHOT_COUNT 0)' %
+                  (storage, snapshot_limit[px]))
+        print('')
+
+    print('max LS_MAX_LED_COUNT')
+    print('  %-16s' % 'pixels' + ''.join('%10s' % e[0] for e in ENCODINGS))
+    raised = False
+    for storage, px in PIXELS:
+        line = '  %-16s' % storage
+        for encoding, enc in ENCODINGS:
+            per_led = rows * px + layers * rows * 4 + (4 if px == 3 else 0) + hw_rows * enc
+            n = (ram_length - fixed - 2 * hw_rows) // per_led
+            mark = ' '
+            if px in snapshot_limit and n > snapshot_limit[px]:
+                per_led += rows * px
+                n = (ram_length - fixed + snapshots - snapshot_header - 2 * hw_rows) // per_led
+                mark = '*'
+                raised = True
+            line += '%9d%s' % (n, mark)
+        print(line)
+    if raised:
+        print('  * with LS_SNAPSHOT_MEMORY raised to one snapshot of max geometry')
+    print('')
+
+    print('streams of %d x %d leds in frame buffer arena' % (rows, leds))
+    for storage, buffers, px in STORAGES:
+        print('  %-16s%10d' % (storage, size['arena'] // (buffers * rows * leds * px)))
+
+
+if __name__ == '__main__':
+    main()